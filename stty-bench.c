@@ -0,0 +1,292 @@
+/* stty-bench -- measure the latency of common stty operations on ptys
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Usage: stty-bench [-n PTYS] [-i ITERATIONS] [-x STTY]
+
+   Build it next to stty.c, with the same flags and libraries plus -lutil.
+   It includes stty.c, so its in-process runs call the same functions
+   that stty does.
+
+   Each operation runs ITERATIONS times on each of PTYS pty pairs made
+   with openpty.  It is run first by calling the core functions of stty.c
+   in this process, and then, with -x, by executing STTY on the pty.
+   Operations that change the settings alternate between two states, so
+   every run changes something.  For each operation the report gives the
+   median and 99th percentile latency in microseconds.  For in-process
+   runs it also gives the terminal system calls per run, as counted by
+   --stats.  An exec'd run makes the same calls plus those of startup.  */
+
+#define main stty_main
+#include "stty.c"
+#undef main
+
+#include <pty.h>
+#include <sys/wait.h>
+
+/* An operation to time: the settings that stty gets as operands, as two
+   null-terminated lists to alternate between, or one list to repeat.
+   OUTPUT is the output style for a query, used when SETTINGS[0] is empty.  */
+struct bench_op
+{
+  char const *name;
+  enum output_type output;
+  char const *settings[2][5];
+};
+
+/* Room for a -g string.  */
+enum { SAVED_BUFSIZE = (4 + NCCS) * (2 * sizeof (unsigned long int) + 1) };
+
+/* The -g strings to restore; filled in by main.  */
+static char restore_raw[SAVED_BUFSIZE];
+static char restore_sane[SAVED_BUFSIZE];
+
+static struct bench_op const bench_ops[] =
+{
+  {"query -g", recoverable, {{nullptr}}},
+  {"query -a", all, {{nullptr}}},
+  {"raw -echo/sane", changed, {{"raw", "-echo"}, {"sane"}}},
+  {"speed", changed, {{"9600"}, {"38400"}}},
+  {"restore -g", changed, {{restore_raw}, {restore_sane}}},
+  {"size", changed, {{"rows", "24", "cols", "80"},
+                     {"rows", "50", "cols", "132"}}},
+};
+
+static int
+cmp_ns (void const *a, void const *b)
+{
+  intmax_t x = *(intmax_t const *) a;
+  intmax_t y = *(intmax_t const *) b;
+  return (x > y) - (x < y);
+}
+
+static intmax_t
+elapsed_ns (struct timespec const *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return ((intmax_t) (now.tv_sec - start->tv_sec) * 1000000000
+          + (now.tv_nsec - start->tv_nsec));
+}
+
+/* Store into BUF the -g string of MODE, as display_recoverable prints
+   it but without the newline.  */
+
+static void
+format_saved (char *buf, struct termios const *mode)
+{
+  int len = sprintf (buf, "%lx:%lx:%lx:%lx",
+                     (unsigned long int) mode->c_iflag,
+                     (unsigned long int) mode->c_oflag,
+                     (unsigned long int) mode->c_cflag,
+                     (unsigned long int) mode->c_lflag);
+  for (size_t i = 0; i < NCCS; i++)
+    len += sprintf (buf + len, ":%lx", (unsigned long int) mode->c_cc[i]);
+}
+
+/* Return the total number of calls counted by --stats so far.  */
+
+static uintmax_t
+stat_calls (void)
+{
+  uintmax_t n = 0;
+  for (int i = 0; i < stat_n_calls; i++)
+    n += stats_device->calls[i].count;
+  return n;
+}
+
+/* Do what stty does for SETTINGS on standard input, or output the
+   settings as OUTPUT if there are none.  */
+
+static void
+run_inprocess (char const *const *settings, enum output_type output)
+{
+  static struct termios mode;
+  char *argv[6] = { (char *) "stty" };
+  int argc = 1;
+  while (settings[argc - 1])
+    {
+      argv[argc] = (char *) settings[argc - 1];
+      argc++;
+    }
+
+  if (timed_tcgetattr (STDIN_FILENO, &mode))
+    error (EXIT_FAILURE, errno, "tcgetattr");
+
+  if (argc == 1)
+    {
+      max_col = 80;
+      current_col = 0;
+      display_settings (output, &mode, "pty");
+      fflush (stdout);
+      return;
+    }
+
+  static struct termios check_mode;
+  bool require_set_attr = false;
+  apply_settings (true, "pty", argv, argc, &check_mode, &require_set_attr);
+  require_set_attr = false;
+  apply_settings (false, "pty", argv, argc, &mode, &require_set_attr);
+  if (require_set_attr)
+    {
+      struct mode_diff diff;
+      if (! apply_and_verify_settings (&mode, "pty", &diff))
+        error (EXIT_FAILURE, 0, "unable to apply %s", argv[1]);
+    }
+}
+
+/* Execute STTY on standard input with SETTINGS, or with the option
+   for OUTPUT if there are none, and wait for it.  */
+
+static void
+run_exec (char const *stty, char const *const *settings,
+          enum output_type output)
+{
+  char *argv[7] = { (char *) stty };
+  int argc = 1;
+  if (!settings[0])
+    argv[argc++] = (char *) (output == all ? "-a" : "-g");
+  for (int i = 0; settings[i]; i++)
+    argv[argc++] = (char *) settings[i];
+
+  pid_t pid = fork ();
+  if (pid < 0)
+    error (EXIT_FAILURE, errno, "fork");
+  if (pid == 0)
+    {
+      execv (stty, argv);
+      _exit (EXIT_CANNOT_INVOKE);
+    }
+  int status;
+  if (waitpid (pid, &status, 0) < 0)
+    error (EXIT_FAILURE, errno, "waitpid");
+  if (! WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    error (EXIT_FAILURE, 0, "%s %s failed", stty, argv[1]);
+}
+
+/* Time OP on each of the N ptys in SLAVES, ITERATIONS times each,
+   in process or else by executing STTY, and report the result.
+   SAMPLES has room for N * ITERATIONS values.  */
+
+static void
+bench (struct bench_op const *op, int const *slaves, int n, int iterations,
+       char const *stty, intmax_t *samples, FILE *report)
+{
+  uintmax_t calls = stat_calls ();
+  int count = 0;
+
+  for (int it = 0; it < iterations; it++)
+    for (int p = 0; p < n; p++)
+      {
+        char const *const *settings
+          = op->settings[op->settings[1][0] ? it & 1 : 0];
+        if (dup2 (slaves[p], STDIN_FILENO) < 0)
+          error (EXIT_FAILURE, errno, "dup2");
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        if (stty)
+          run_exec (stty, settings, op->output);
+        else
+          run_inprocess (settings, op->output);
+        samples[count++] = elapsed_ns (&start);
+      }
+
+  qsort (samples, count, sizeof *samples, cmp_ns);
+  fprintf (report, "%-16s %-10s %10.1f %10.1f", op->name,
+           stty ? "exec" : "in-process",
+           samples[count / 2] / 1e3, samples[count * 99 / 100] / 1e3);
+  if (stty)
+    fputs ("          -\n", report);
+  else
+    fprintf (report, " %9.1f\n", (double) (stat_calls () - calls) / count);
+}
+
+int
+main (int argc, char **argv)
+{
+  int n = 8;
+  int iterations = 200;
+  char const *stty = nullptr;
+  int c;
+
+  set_program_name (argv[0]);
+
+  while ((c = getopt (argc, argv, "n:i:x:")) != -1)
+    switch (c)
+      {
+      case 'n':
+        n = integer_arg (optarg, 1024);
+        break;
+      case 'i':
+        iterations = integer_arg (optarg, INT_MAX / 1024);
+        break;
+      case 'x':
+        stty = optarg;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-n PTYS] [-i ITERATIONS] [-x STTY]\n",
+                 program_name);
+        return EXIT_FAILURE;
+      }
+  if (n == 0 || iterations == 0)
+    error (EXIT_FAILURE, 0, "PTYS and ITERATIONS must be positive");
+
+  int *slaves = xnmalloc (n, sizeof *slaves);
+  for (int p = 0; p < n; p++)
+    {
+      int master;
+      if (openpty (&master, &slaves[p], nullptr, nullptr, nullptr) < 0)
+        error (EXIT_FAILURE, errno, "openpty");
+    }
+
+  /* The -g strings of a raw and a sane terminal.  */
+  struct termios mode;
+  if (tcgetattr (slaves[0], &mode))
+    error (EXIT_FAILURE, errno, "tcgetattr");
+  sane_mode (&mode);
+  format_saved (restore_sane, &mode);
+  mode.c_iflag = mode.c_oflag = 0;
+  mode.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+  format_saved (restore_raw, &mode);
+
+  /* Output of the operations goes to /dev/null, the report to the
+     original standard output.  */
+  int report_fd = dup (STDOUT_FILENO);
+  FILE *report = report_fd < 0 ? nullptr : fdopen (report_fd, "w");
+  if (!report)
+    error (EXIT_FAILURE, errno, "standard output");
+  int null_fd = open ("/dev/null", O_WRONLY);
+  if (null_fd < 0 || dup2 (null_fd, STDOUT_FILENO) < 0)
+    error (EXIT_FAILURE, errno, "/dev/null");
+
+  stats_output = "text";
+  stats_new_device ("pty");
+  intmax_t *samples = xnmalloc ((size_t) n * iterations, sizeof *samples);
+
+  fprintf (report, "%d ptys, %d iterations\n", n, iterations);
+  fprintf (report, "%-16s %-10s %10s %10s %9s\n",
+           "operation", "how", "p50 us", "p99 us", "calls");
+  for (int i = 0; i < countof (bench_ops); i++)
+    {
+      bench (&bench_ops[i], slaves, n, iterations, nullptr, samples, report);
+      if (stty)
+        bench (&bench_ops[i], slaves, n, iterations, stty, samples, report);
+    }
+
+  stats_output = nullptr;
+  if (fclose (report) != 0)
+    error (EXIT_FAILURE, errno, "write error");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,442 @@
+/* stty-fuzz -- drive the stty setting parsers with generated input
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Usage: stty-fuzz [-n CASES] [-s SEED] [-v]
+
+   Build it next to stty.c with the same flags and libraries, and
+   preferably with -fsanitize=address,undefined.  It includes stty.c.
+
+   Each case does one of the following:
+   - passes a generated argument vector to apply_settings in checking
+     mode;
+   - passes a generated token to string_to_baud, integer_arg or
+     parse_control_value;
+   - passes a mutated -g string to recover_mode.
+
+   Everything runs on an in-memory termios, with the ---fake-tty backend
+   in place and standard input on /dev/null, so no device is touched.
+   Input that stty rejects ends in error or usage, and both return to
+   the driver here instead of exiting.  The report gives arguments per
+   second and a digest of every outcome.  The same seed gives the same
+   digest unless the parsers' behavior changed, so a change meant only
+   to be faster can be checked with it.  -v prints each case and its
+   outcome, for use as a corpus.  */
+
+/* Calls of exit in stty.c, such as the one in usage, return to the
+   driver.  The macro renames the declaration in <stdlib.h> too, so it
+   must come before stty.c includes that header.  */
+#define exit(status) fuzz_exit (status)
+#define main stty_main
+#include "stty.c"
+#undef main
+#undef exit
+_Noreturn void exit (int);
+
+#include <setjmp.h>
+
+/* Room for a token, which may be a -g string, and the most tokens in
+   an argument vector.  */
+enum
+{
+  TOKEN_SIZE = (4 + NCCS) * (2 * sizeof (unsigned long int) + 1),
+  MAX_ARGS = 8
+};
+
+/* Where to go when the case being run fails, and whether one is.  */
+static jmp_buf fuzz_env;
+static bool in_case;
+
+void
+fuzz_exit (int status)
+{
+  if (in_case)
+    longjmp (fuzz_env, 1);
+  exit (status);
+}
+
+/* Interpose the library's error, which the parsers and the gnulib
+   functions they call use to reject input.  */
+
+void
+(error) (int status, int errnum, char const *format, ...)
+{
+  if (status && in_case)
+    longjmp (fuzz_env, 1);
+  if (!in_case)
+    {
+      va_list args;
+      va_start (args, format);
+      fprintf (stderr, "%s: ", program_name);
+      vfprintf (stderr, format, args);
+      va_end (args);
+      if (errnum)
+        fprintf (stderr, ": %s", strerror (errnum));
+      putc ('\n', stderr);
+    }
+  if (status)
+    exit (status);
+}
+
+/* A small, fast generator, so that a seed always gives the same cases.  */
+static uint64_t fuzz_state;
+
+static uint64_t
+rnd (void)
+{
+  fuzz_state ^= fuzz_state << 13;
+  fuzz_state ^= fuzz_state >> 7;
+  fuzz_state ^= fuzz_state << 17;
+  return fuzz_state;
+}
+
+static int
+rnd_below (int n)
+{
+  return rnd () % n;
+}
+
+/* Return H, an FNV-1a hash, updated with the N bytes at P.  */
+
+static uint64_t
+digest_add (uint64_t h, void const *p, size_t n)
+{
+  unsigned char const *b = p;
+  for (size_t i = 0; i < n; i++)
+    h = (h ^ b[i]) * UINT64_C (0x100000001b3);
+  return h;
+}
+
+static uint64_t
+digest_add_value (uint64_t h, uintmax_t value)
+{
+  return digest_add (h, &value, sizeof value);
+}
+
+/* Store into *MODE the mode that each case starts with: sane, 8 bits
+   at 38400 baud.  */
+
+static void
+start_mode (struct termios *mode)
+{
+  memset (mode, 0, sizeof *mode);
+  sane_mode (mode);
+  mode->c_cflag |= CS8 | CREAD;
+  cfsetispeed (mode, B38400);
+  cfsetospeed (mode, B38400);
+}
+
+/* Keywords that take no place in mode_info or control_info.  */
+static char const *const extra_keywords[] =
+{
+  "ispeed", "ospeed", "rows", "cols", "columns", "size", "line", "speed",
+  "drain", "low_latency", "xmit_fifo_size", "latency", "batch", "throughput",
+  "queue", "icount", "drainflush", "iflush", "oflush", "ioflush", "ooff",
+  "oon", "ioff", "ion", "dtr", "rts", "modem", "close_delay", "closing_wait",
+  "rs485", "rts_on_send", "rts_after_send", "rx_during_tx",
+  "rts_delay_before", "rts_delay_after", "excl", "exta", "extb", "undef",
+};
+
+/* Store into BUF a token that is likely to be some setting's value.  */
+
+static void
+gen_value (char *buf, size_t size)
+{
+  static char const *const fixed[] =
+  {
+    "", "0", "-1", "^", "^?", "^-", "^@", "^a", "^\\", "undef", "none",
+    "infinite", "134.5", "134.50001", "9600.", ".5", "0x1f", "077", "1e3",
+    "4294967296", "18446744073709551616", "255", "256", "M-^?", "exta",
+  };
+
+  switch (rnd_below (4))
+    {
+    case 0:
+      snprintf (buf, size, "%s", fixed[rnd_below (countof (fixed))]);
+      break;
+    case 1:
+      {
+        uintmax_t value = rnd ();
+        snprintf (buf, size, "%ju", value >> rnd_below (64));
+      }
+      break;
+    case 2:
+      {
+        /* One call per statement: the order in which arguments are
+           evaluated is unspecified, and the cases must not depend on
+           the compiler.  */
+        int whole = rnd_below (5000000);
+        int width = rnd_below (6);
+        snprintf (buf, size, "%d.%0*d", whole, width, rnd_below (100000));
+      }
+      break;
+    default:
+      {
+        size_t len = rnd_below (MIN (size - 1, 12));
+        for (size_t i = 0; i < len; i++)
+          buf[i] = 1 + rnd_below (255);
+        buf[len] = '\0';
+      }
+      break;
+    }
+}
+
+/* Store into BUF a -g string for a random mode, then mangle it.  */
+
+static void
+gen_saved (char *buf)
+{
+  struct termios mode;
+  unsigned char *p = (unsigned char *) &mode;
+  for (size_t i = 0; i < sizeof mode; i++)
+    p[i] = rnd ();
+  int len = sprintf (buf, "%lx:%lx:%lx:%lx",
+                     (unsigned long int) mode.c_iflag,
+                     (unsigned long int) mode.c_oflag,
+                     (unsigned long int) mode.c_cflag,
+                     (unsigned long int) mode.c_lflag);
+  for (size_t i = 0; i < NCCS; i++)
+    len += sprintf (buf + len, ":%lx", (unsigned long int) mode.c_cc[i]);
+
+  static char const alphabet[] = "0123456789abcdefx:-g ";
+  for (int m = rnd_below (4); 0 < m; m--)
+    {
+      size_t len = strlen (buf);
+      size_t at = len ? rnd_below (len) : 0;
+      switch (rnd_below (3))
+        {
+        case 0:
+          buf[at] = '\0';
+          break;
+        case 1:
+          if (len)
+            buf[at] = alphabet[rnd_below (sizeof alphabet - 1)];
+          break;
+        default:
+          if (len)
+            memmove (buf + at, buf + at + 1, len - at);
+          break;
+        }
+    }
+}
+
+/* Store into BUF, of SIZE bytes, a token of the kind apply_settings
+   gets: usually a keyword, possibly negated, otherwise a value or
+   a -g string.  */
+
+static void
+gen_token (char *buf, size_t size)
+{
+  int r = rnd_below (20);
+  if (r < 12)
+    {
+      char const *name;
+      int n = countof (mode_info) - 1 + countof (control_info) - 1
+              + countof (extra_keywords);
+      int i = rnd_below (n);
+      if (i < countof (mode_info) - 1)
+        name = mode_info[i].name;
+      else if ((i -= countof (mode_info) - 1) < countof (control_info) - 1)
+        name = control_info[i].name;
+      else
+        name = extra_keywords[i - (countof (control_info) - 1)];
+      snprintf (buf, size, "%s%s", rnd_below (5) ? "" : "-", name);
+    }
+  else if (r < 18)
+    gen_value (buf, size);
+  else
+    gen_saved (buf);
+}
+
+/* Return H updated with the parts of MODE the parsers can change.  */
+
+static uint64_t
+digest_mode (uint64_t h, struct termios const *mode)
+{
+  h = digest_add_value (h, mode->c_iflag);
+  h = digest_add_value (h, mode->c_oflag);
+  h = digest_add_value (h, mode->c_cflag);
+  h = digest_add_value (h, mode->c_lflag);
+  h = digest_add (h, mode->c_cc, NCCS);
+  h = digest_add_value (h, cfgetispeed (mode));
+  return digest_add_value (h, cfgetospeed (mode));
+}
+
+/* Forget what earlier cases set outside of the termios.  */
+
+static void
+reset_globals (void)
+{
+  tcsetattr_options = TCSADRAIN;
+  tty_actions = 0;
+#if USE_TIOCM
+  modem_set = modem_clear = 0;
+#endif
+  read_latency = read_batch = -1;
+}
+
+/* Run the case of kind KIND on the NVEC arguments in VEC, with control
+   character CC and integer limit MAX where the kind needs them, and the
+   mode in *MODE.  Return whether it was accepted, and if so store its
+   result in *RESULT.  */
+
+static bool
+run_case (int kind, char **vec, int nvec, struct control_info const *cc,
+          uintmax_t max, struct termios *mode, uintmax_t *result)
+{
+  bool ok = false;
+  in_case = true;
+  if (!setjmp (fuzz_env))
+    {
+      switch (kind)
+        {
+        case 4:
+          *result = string_to_baud (vec[1]);
+          break;
+        case 5:
+          *result = integer_arg (vec[1], max);
+          break;
+        case 6:
+          *result = parse_control_value (cc->name, vec[1]);
+          break;
+        case 7:
+          *result = recover_mode (vec[1], mode);
+          break;
+        default:
+          {
+            bool require_set_attr = false;
+            apply_settings (true, "fuzz", vec, nvec, mode,
+                            &require_set_attr);
+            *result = require_set_attr;
+          }
+          break;
+        }
+      ok = true;
+    }
+  in_case = false;
+  return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+  uintmax_t cases = 1000000;
+  uint64_t seed = 1;
+  bool verbose = false;
+  int c;
+
+  set_program_name (argv[0]);
+
+  while ((c = getopt (argc, argv, "n:s:v")) != -1)
+    switch (c)
+      {
+      case 'n':
+        cases = integer_arg (optarg, UINTMAX_MAX);
+        break;
+      case 's':
+        seed = integer_arg (optarg, UINT64_MAX);
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-n CASES] [-s SEED] [-v]\n",
+                 program_name);
+        return EXIT_FAILURE;
+      }
+  fuzz_state = seed ? seed : 1;
+
+  use_fake_tty (nullptr);
+  int null_fd = open ("/dev/null", O_RDWR);
+  if (null_fd < 0 || dup2 (null_fd, STDIN_FILENO) < 0)
+    error (EXIT_FAILURE, errno, "/dev/null");
+  /* Keep usage messages out of the way, unless asked for the corpus.  */
+  int stderr_fd = dup (STDERR_FILENO);
+  if (!verbose && dup2 (null_fd, STDERR_FILENO) < 0)
+    error (EXIT_FAILURE, errno, "/dev/null");
+
+  static char tokens[MAX_ARGS][TOKEN_SIZE];
+  uint64_t digest = UINT64_C (0xcbf29ce484222325);
+  uintmax_t args = 0;
+  uintmax_t rejected = 0;
+  struct timespec start;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  for (uintmax_t i = 0; i < cases; i++)
+    {
+      char *vec[MAX_ARGS + 1] = { (char *) "stty" };
+      int nvec = 1;
+      int kind = rnd_below (8);
+      struct termios mode;
+      start_mode (&mode);
+      reset_globals ();
+
+      /* Generate the whole case before running it, so a failure in one
+         case does not change the input of the next.  */
+      int ntokens = kind < 4 ? 1 + rnd_below (MAX_ARGS - 1) : 1;
+      for (int t = 0; t < ntokens; t++)
+        {
+          if (kind == 7)
+            gen_saved (tokens[t]);
+          else if (4 <= kind)
+            gen_value (tokens[t], TOKEN_SIZE);
+          else
+            gen_token (tokens[t], TOKEN_SIZE);
+          vec[nvec++] = tokens[t];
+        }
+      struct control_info const *cc
+        = &control_info[rnd_below (countof (control_info) - 1)];
+      uintmax_t max = rnd ();
+      max >>= rnd_below (64);
+      args += ntokens;
+
+      uintmax_t result;
+      bool ok = run_case (kind, vec, nvec, cc, max, &mode, &result);
+
+      rejected += !ok;
+      digest = digest_add (digest, &ok, 1);
+      if (ok)
+        {
+          digest = digest_add_value (digest, result);
+          digest = digest_add_value (digest, result >> 31 >> 1);
+          digest = digest_mode (digest, &mode);
+        }
+
+      if (verbose)
+        {
+          printf ("%s %d", ok ? "accept" : "reject", kind);
+          if (kind == 5)
+            printf (" max=%ju", max);
+          else if (kind == 6)
+            printf (" %s", cc->name);
+          for (int t = 1; t < nvec; t++)
+            {
+              putchar (' ');
+              json_string (stdout, vec[t]);
+            }
+          if (ok)
+            printf (" = %ju", (uintmax_t) result);
+          putchar ('\n');
+        }
+    }
+
+  double secs = ms_since (&start) / 1e3;
+  dup2 (stderr_fd, STDERR_FILENO);
+  fprintf (stderr,
+           "%ju cases, %ju arguments, %ju rejected in %.2f s:"
+           " %.0f arguments/s, digest %016" PRIx64 "\n",
+           cases, args, rejected, secs, secs ? args / secs : 0.0, digest);
+  return EXIT_SUCCESS;
+}
@@ -52,14 +52,69 @@
 #endif
 #include <getopt.h>
 #include <stdarg.h>
+/* Use the UART driver interface when configure did not say, but the
+   header is there.  */
+#if !defined HAVE_LINUX_SERIAL_H && defined __has_include
+# if __has_include (<linux/serial.h>)
+#  define HAVE_LINUX_SERIAL_H 1
+# endif
+#endif
+#if HAVE_LINUX_SERIAL_H
+# include <linux/serial.h>
+#endif
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+/* Use signalfd when configure did not say, but the header is there.  */
+#if !defined HAVE_SYS_SIGNALFD_H && defined __has_include
+# if __has_include (<sys/signalfd.h>)
+#  define HAVE_SYS_SIGNALFD_H 1
+# endif
+#endif
+#if HAVE_SYS_SIGNALFD_H
+# include <sys/signalfd.h>
+#endif
 
 #include "system.h"
+#include "argmatch.h"
 #include "assure.h"
 #include "c-ctype.h"
 #include "fd-reopen.h"
+#include "full-write.h"
 #include "quote.h"
 #include "xdectoint.h"
+#include "xnanosleep.h"
 #include "xstrtol.h"
+#include "xvasprintf.h"
+
+#if !defined TIOCINQ && defined FIONREAD
+# define TIOCINQ FIONREAD
+#endif
+
+/* Whether UART error counters can be read with TIOCGICOUNT.  */
+#if defined TIOCGICOUNT && HAVE_LINUX_SERIAL_H
+# define USE_TIOCGICOUNT 1
+#endif
+
+/* Whether UART driver settings can be changed with TIOCSSERIAL.  */
+#if defined TIOCGSERIAL && defined TIOCSSERIAL && defined ASYNC_LOW_LATENCY
+# define USE_TIOCSSERIAL 1
+#endif
+
+/* Whether the RS-485 mode of a UART can be changed with TIOCSRS485.  */
+#if defined TIOCGRS485 && defined TIOCSRS485 && HAVE_LINUX_SERIAL_H
+# define USE_TIOCSRS485 1
+#endif
+
+/* Whether modem control lines can be read and changed.  */
+#if defined TIOCMGET && defined TIOCMBIS && defined TIOCMBIC
+# define USE_TIOCM 1
+#endif
 
 /* The official name of this program (e.g., no 'g' prefix).  */
 #define PROGRAM_NAME "stty"
@@ -168,6 +223,33 @@
 # define CSTATUS Control ('t')
 #endif
 
+/* The states saved for --undo: a ring of HISTORY_SLOTS fixed-size
+   records per device, each overwritten in place without fsync.  The
+   records hold native structures, so they are only meant to be read
+   back by the same build on the same system.  */
+enum { HISTORY_SLOTS = 16 };
+#define HISTORY_MAGIC 0x73747901
+
+struct history_record
+{
+  uint32_t magic;		/* HISTORY_MAGIC in a used slot.  */
+  uint32_t seq;			/* Increases by 1 with each record.  */
+  int64_t when;			/* Seconds since the Epoch.  */
+  struct termios mode;
+  int32_t rows, cols;		/* -1 if the size is unknown.  */
+};
+
+/* The fields that -g appends for a device with RS-485 settings:
+   the flags that stty changes, and the two RTS delays.  */
+enum { RS485_FIELDS = 3 };
+
+/* Size of a buffer big enough for the -g output, including the newline
+   and the terminating null: 4 flag words and NCCS control characters,
+   each at most 2 hex digits per byte plus a separator, and then the
+   RS-485 fields.  */
+#define RECOVERABLE_BUFSIZE ((4 + NCCS) * (2 * sizeof (unsigned long int) + 1) \
+                             + RS485_FIELDS * (2 * sizeof (uint32_t) + 1) + 2)
+
 /* Which speeds to set.  */
 enum speed_setting
   {
@@ -177,9 +259,59 @@ enum speed_setting
 /* What to output and how.  */
 enum output_type
   {
-    changed, all, recoverable	/* Default, -a, -g.  */
+    changed, all, recoverable, json,	/* Default, -a, -g, --json.  */
+    fingerprint				/* --fingerprint.  */
+  };
+
+/* Whether to block for window size changes.  */
+enum size_wait
+  {
+    no_size_wait, size_wait_once, size_wait_watch  /* --wait-size, --watch-size.  */
+  };
+
+/* What to do when output has not drained within --drain-timeout.  */
+enum drain_policy
+  {
+    drain_now, drain_flush, drain_fail
+  };
+
+static char const *const drain_policy_args[] =
+{
+  "now", "flush", "fail", nullptr
+};
+static enum drain_policy const drain_policy_types[] =
+{
+  drain_now, drain_flush, drain_fail
+};
+
+/* Arguments of --modem-order, saying when to change modem control lines.  */
+static char const *const modem_order_args[] =
+{
+  "before", "after", nullptr
+};
+static bool const modem_order_types[] =
+{
+  true, false
+};
+
+/* Parts of the settings that --fingerprint covers, as named by --fields.
+   The flag words come first, at 1 << their 'enum mode_type'.  */
+enum
+  {
+    FP_CFLAG = 1 << 0, FP_IFLAG = 1 << 1, FP_OFLAG = 1 << 2,
+    FP_LFLAG = 1 << 3, FP_CC = 1 << 4, FP_SPEED = 1 << 5,
+    FP_ALL = (1 << 6) - 1
   };
 
+static char const *const fingerprint_field_args[] =
+{
+  "cflag", "iflag", "oflag", "lflag", "cc", "speed", nullptr
+};
+static int const fingerprint_field_types[] =
+{
+  FP_CFLAG, FP_IFLAG, FP_OFLAG, FP_LFLAG, FP_CC, FP_SPEED
+};
+
 /* Which member(s) of 'struct termios' a mode uses.  */
 enum mode_type
   {
@@ -193,6 +325,17 @@ enum mode_type
 #define OMIT 8			/* Don't display value. */
 #define NO_SETATTR 16		/* tcsetattr not used to set mode bits.  */
 
+/* Parts of a requested mode that the device did not apply.  */
+struct mode_diff
+  {
+    tcflag_t iflag, oflag, cflag, lflag;	/* Bits that differ.  */
+    bool cc[NCCS];		/* Control characters that differ.  */
+    bool ispeed, ospeed;	/* Speeds that differ.  */
+#ifdef HAVE_C_LINE
+    bool line;			/* Line discipline differs.  */
+#endif
+  };
+
 /* Each mode.  */
 struct mode_info
   {
@@ -379,6 +522,34 @@ static struct mode_info const mode_info[] =
   {nullptr, control, 0, 0, 0}
 };
 
+/* Queue flushing and flow control actions.  These are not settings:
+   each is performed once, either before or after applying the settings.  */
+enum
+  {
+    ACT_OFLUSH = 1,		/* Before: tcflush (TCOFLUSH).  */
+    ACT_IOFF = 2,		/* Before: tcflow (TCIOFF).  */
+    ACT_IFLUSH = 4,		/* After: tcflush (TCIFLUSH).  */
+    ACT_OOFF = 8,		/* After: tcflow (TCOOFF).  */
+    ACT_OON = 16,		/* After: tcflow (TCOON).  */
+    ACT_ION = 32		/* After: tcflow (TCION).  */
+  };
+
+static struct
+{
+  char const *name;
+  int actions;
+} const tty_action_info[] =
+{
+  {"iflush", ACT_IFLUSH},
+  {"oflush", ACT_OFLUSH},
+  {"ioflush", ACT_IFLUSH | ACT_OFLUSH},
+  {"ooff", ACT_OOFF},
+  {"oon", ACT_OON},
+  {"ioff", ACT_IOFF},
+  {"ion", ACT_ION},
+  {nullptr, 0}
+};
+
 /* Control character settings.  */
 struct control_info
   {
@@ -438,6 +609,7 @@ static struct control_info const control_info[] =
 
 static char const *visible (cc_t ch);
 static unsigned long int baud_to_value (speed_t speed);
+static speed_t value_to_baud (unsigned long int value);
 static bool recover_mode (char const *arg, struct termios *mode);
 static int screen_columns (void);
 static bool set_mode (struct mode_info const *info, bool reversed,
@@ -449,6 +621,55 @@ static tcflag_t *mode_type_flag (enum mode_type type, struct termios *mode);
 static void display_all (struct termios *mode, char const *device_name);
 static void display_changed (struct termios *mode);
 static void display_recoverable (struct termios *mode);
+static void display_json (struct termios *mode, char const *device_name);
+static void display_queue (bool fancy, char const *device_name);
+static void display_icount (bool fancy, char const *device_name);
+static void watch_icount (bool as_json, char const *device_name);
+static void watch_queues (bool use_stdin, char const *device_name,
+                          int argc, char **argv);
+static void display_throughput (struct termios const *mode, bool fancy);
+static void bench_throughput (struct termios const *mode,
+                              char const *device_name);
+static bool process_option (int optc, bool *verbose_output,
+                            bool *recoverable_output,
+                            enum output_type *output_type, char **file_name,
+                            bool *noargs, char **argv, int *argi, int *opti);
+static void validate_options (bool verbose_output, bool recoverable_output,
+                              bool noargs, enum output_type output_type);
+static void open_device_file (char const *device_name);
+static int open_ptys (int n, char **argv, int argc);
+static void configure_stdin (char const *name, char **argv, int argc);
+static void run_rfc2217 (char *targets, enum output_type output_type,
+                         bool display, char **argv, int argc);
+static void probe_window_size (struct termios const *mode,
+                               char const *file_name,
+                               char const *device_name);
+static int broadcast_window_size (char const *device_name,
+                                  int argc, char **argv);
+static void history_capture (struct history_record *rec,
+                             struct termios const *mode);
+static void history_save (struct history_record *rec, struct termios *mode,
+                          char const *device_name);
+static void display_history (char const *device_name);
+static void undo_settings (int n, char const *device_name);
+static int format_modes (char *buf, struct termios const *mode);
+static int parse_fingerprint_fields (char *arg);
+static void lock_device_file (char const *file_name,
+                              char const *device_name);
+static void perform_tty_actions (bool before, char const *device_name);
+static void set_modem_lines (char const *device_name);
+static int parse_modem_lines (char const *arg);
+static void display_modem (bool fancy, char const *device_name);
+static void wait_modem (char const *device_name);
+static bool apply_and_verify_settings (struct termios *mode,
+                                       char const *device_name,
+                                       struct mode_diff *diff);
+static void diff_modes (struct termios const *requested,
+                        struct termios const *actual, struct mode_diff *diff);
+static void print_mode_differences (struct termios const *mode,
+                                    struct termios const *new_mode,
+                                    struct mode_diff const *diff);
+static int format_recoverable (char *buf, struct termios const *mode);
 static void display_settings (enum output_type output_type,
                               struct termios *mode,
                               char const *device_name);
@@ -461,7 +682,25 @@ static void set_control_char (struct control_info const *info,
                               struct termios *mode);
 static void set_speed (enum speed_setting type, char const *arg,
                        struct termios *mode);
+static void set_read_timing (struct termios *mode);
+static int frame_bits (struct termios const *mode);
+static unsigned long int line_baud (struct termios const *mode);
 static void set_window_size (int rows, int cols, char const *device_name);
+#if USE_TIOCSSERIAL
+static void display_serial_info (void);
+#if USE_TIOCSRS485
+static void display_rs485_info (void);
+#endif
+#endif
+#if USE_TIOCSRS485
+static int format_rs485 (char *buf, struct serial_rs485 const *rs);
+static bool parse_rs485 (char const *s, struct serial_rs485 *rs);
+static char const *rs485_fields (char const *arg);
+#endif
+#ifdef TIOCGWINSZ
+static int get_win_size (int fd, struct winsize *win);
+#endif
+static void wait_window_size (enum size_wait how, char const *device_name);
 
 /* The width of the screen, for output wrapping. */
 static int max_col;
@@ -472,9 +711,110 @@ static int current_col;
 /* Default "drain" mode for tcsetattr.  */
 static int tcsetattr_options = TCSADRAIN;
 
+/* Whether to hold an exclusive lock on the device while changing it,
+   and for how many milliseconds to wait for one, or -1 for no limit.  */
+static bool lock_device;
+static int lock_timeout = -1;
+
+/* With --broadcast-size, the size to give the devices named by the
+   operands, or null to copy that of standard input; and the number of
+   milliseconds over which to spread the changes (--stagger).  */
+static bool broadcast_size;
+static char const *broadcast_size_arg;
+static int stagger_ms;
+
+/* Whether to ask the terminal itself for its size (--probe-size).  */
+static bool probe_size;
+
+/* With --rfc2217, the comma-separated HOST:PORT addresses of the
+   terminal server ports to use instead of a local device, or null.  */
+static char *rfc2217_targets;
+
+/* With --openpty=N, how many ptys to create and configure, or 0; and
+   the shell command to run with them (--run), or null.  */
+static int openpty_count;
+static char const *openpty_command;
+
+/* With --undo=N, which saved state to restore, counting from 1 for the
+   most recent; or 0.  */
+static int undo_index;
+
+/* Whether to list the saved states (--history).  */
+static bool history_output;
+
+/* FP_* parts of the settings that --fingerprint hashes, or 0 if
+   --fields was not given.  */
+static int fingerprint_fields;
+
+/* ACT_* actions requested.  */
+static int tty_actions;
+
+#if USE_TIOCM
+/* Modem control lines, as reported by "stty modem".  Only DTR and RTS
+   are outputs that can be set.  */
+static struct
+{
+  char const *name;
+  int bit;
+} const modem_lines[] =
+{
+  {"dtr", TIOCM_DTR},
+  {"rts", TIOCM_RTS},
+  {"cts", TIOCM_CTS},
+  {"dsr", TIOCM_DSR},
+  {"cd", TIOCM_CAR},
+  {"ri", TIOCM_RNG},
+};
+
+/* TIOCM_* modem control lines to raise and to lower.  */
+static int modem_set;
+static int modem_clear;
+#endif
+
+/* Whether to change them before applying the settings, not after.  */
+static bool modem_before;
+
+/* TIOCM_* input lines that --wait-modem waits for, or 0.  */
+static int wait_modem_lines;
+
+/* Milliseconds to wait for output to drain before applying
+   settings, or -1 to let tcsetattr wait as long as it takes.  */
+static int drain_timeout = -1;
+
+/* What to do if that time runs out.  */
+static enum drain_policy drain_policy = drain_now;
+
 /* Extra info to aid stty development.  */
 static bool dev_debug;
 
+/* Set by --bench.  */
+static bool bench_output;
+
+/* Set by --fingerprint.  */
+static bool fingerprint_output;
+
+/* Set by --wait-size or --watch-size.  */
+static enum size_wait size_wait = no_size_wait;
+
+/* Report format for --stats ("text" or "json"), or null if not enabled.  */
+static char const *stats_output;
+
+/* Milliseconds between --watch-queue samples, or -1 if not watching.  */
+static int watch_queue_interval = -1;
+
+/* Milliseconds between --watch-icount samples, or -1 if not watching.  */
+static int watch_icount_interval = -1;
+
+/* Milliseconds to wait for a size change or to keep watching,
+   or -1 for no limit.  */
+static int wait_timeout = -1;
+
+/* Requested read latency in milliseconds and batch size in characters,
+   or -1 if not given.  They are turned into VMIN and VTIME only after
+   all other settings, as they depend on the speed and character format.  */
+static int read_latency = -1;
+static int read_batch = -1;
+
 /* Record last speed set for correlation.  */
 static speed_t last_ibaud = (speed_t) -1;
 static speed_t last_obaud = (speed_t) -1;
@@ -484,6 +824,30 @@ static speed_t last_obaud = (speed_t) -1;
 enum
 {
   DEV_DEBUG_OPTION = CHAR_MAX + 1,
+  FAKE_TTY_OPTION,
+  BROADCAST_SIZE_OPTION,
+  DRAIN_POLICY_OPTION,
+  BENCH_OPTION,
+  DRAIN_TIMEOUT_OPTION,
+  FIELDS_OPTION,
+  FINGERPRINT_OPTION,
+  HISTORY_OPTION,
+  JSON_OPTION,
+  LOCK_OPTION,
+  MODEM_ORDER_OPTION,
+  OPENPTY_OPTION,
+  PROBE_SIZE_OPTION,
+  RFC2217_OPTION,
+  RUN_OPTION,
+  STAGGER_OPTION,
+  STATS_OPTION,
+  TIMEOUT_OPTION,
+  UNDO_OPTION,
+  WATCH_ICOUNT_OPTION,
+  WATCH_QUEUE_OPTION,
+  WAIT_MODEM_OPTION,
+  WAIT_SIZE_OPTION,
+  WATCH_SIZE_OPTION,
 };
 
 static struct option const longopts[] =
@@ -492,6 +856,30 @@ static struct option const longopts[] =
   {"save", no_argument, nullptr, 'g'},
   {"file", required_argument, nullptr, 'F'},
   {"-debug", no_argument, nullptr, DEV_DEBUG_OPTION},
+  {"-fake-tty", optional_argument, nullptr, FAKE_TTY_OPTION},
+  {"bench", no_argument, nullptr, BENCH_OPTION},
+  {"broadcast-size", optional_argument, nullptr, BROADCAST_SIZE_OPTION},
+  {"drain-policy", required_argument, nullptr, DRAIN_POLICY_OPTION},
+  {"drain-timeout", required_argument, nullptr, DRAIN_TIMEOUT_OPTION},
+  {"fields", required_argument, nullptr, FIELDS_OPTION},
+  {"fingerprint", no_argument, nullptr, FINGERPRINT_OPTION},
+  {"history", no_argument, nullptr, HISTORY_OPTION},
+  {"json", no_argument, nullptr, JSON_OPTION},
+  {"lock", optional_argument, nullptr, LOCK_OPTION},
+  {"modem-order", required_argument, nullptr, MODEM_ORDER_OPTION},
+  {"openpty", required_argument, nullptr, OPENPTY_OPTION},
+  {"probe-size", no_argument, nullptr, PROBE_SIZE_OPTION},
+  {"rfc2217", required_argument, nullptr, RFC2217_OPTION},
+  {"run", required_argument, nullptr, RUN_OPTION},
+  {"stagger", required_argument, nullptr, STAGGER_OPTION},
+  {"stats", optional_argument, nullptr, STATS_OPTION},
+  {"timeout", required_argument, nullptr, TIMEOUT_OPTION},
+  {"undo", optional_argument, nullptr, UNDO_OPTION},
+  {"wait-modem", required_argument, nullptr, WAIT_MODEM_OPTION},
+  {"wait-size", no_argument, nullptr, WAIT_SIZE_OPTION},
+  {"watch-size", no_argument, nullptr, WATCH_SIZE_OPTION},
+  {"watch-icount", required_argument, nullptr, WATCH_ICOUNT_OPTION},
+  {"watch-queue", required_argument, nullptr, WATCH_QUEUE_OPTION},
   {GETOPT_HELP_OPTION_DECL},
   {GETOPT_VERSION_OPTION_DECL},
   {nullptr, 0, nullptr, 0}
@@ -501,7 +889,6 @@ static struct option const longopts[] =
    Wrap to next line first if it won't fit.
    Print a space first unless MESSAGE will start a new line. */
 
-ATTRIBUTE_FORMAT ((printf, 1, 2))
 static void print_newline_if_needed(int buflen)
 {
   if (max_col - current_col <= buflen)
@@ -559,274 +946,878 @@ static void wrapf(char const *message,...)
   current_col += buflen;
 }
 
-void print_usage_header(void)
+/* Set *DEADLINE to MS milliseconds from now,
+   or mark it unset (tv_sec < 0) if MS is negative.  */
+
+static void
+deadline_from_ms (struct timespec *deadline, int ms)
 {
-    printf(_("\
-Usage: %s [-F DEVICE | --file=DEVICE] [SETTING]...\n\
-  or:  %s [-F DEVICE | --file=DEVICE] [-a|--all]\n\
-  or:  %s [-F DEVICE | --file=DEVICE] [-g|--save]\n\
-"),
-            program_name, program_name, program_name);
-    fputs(_("\
-Print or change terminal characteristics.\n\
-"), stdout);
-    emit_mandatory_arg_note();
-    fputs(_("\
-  -a, --all          print all current settings in human-readable form\n\
-  -g, --save         print all current settings in a stty-readable form\n\
-  -F, --file=DEVICE  open and use DEVICE instead of standard input\n\
-"), stdout);
-    fputs(HELP_OPTION_DESCRIPTION, stdout);
-    fputs(VERSION_OPTION_DESCRIPTION, stdout);
-    fputs(_("\
-\n\
-Optional - before SETTING indicates negation.  An * marks non-POSIX\n\
-settings.  The underlying system defines which settings are available.\n\
-"), stdout);
+  if (ms < 0)
+    {
+      deadline->tv_sec = -1;
+      return;
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += ms / 1000;
+  deadline->tv_nsec += (ms % 1000) * 1000000;
+  if (1000000000 <= deadline->tv_nsec)
+    {
+      deadline->tv_sec++;
+      deadline->tv_nsec -= 1000000000;
+    }
 }
 
-void print_special_characters(void)
+/* Return the milliseconds elapsed since START.  */
+
+static intmax_t
+ms_since (struct timespec const *start)
 {
-    fputs(_("\
-\n\
-Special characters:\n"), stdout);
-#ifdef VFLUSHO
-    fputs(_("\
- * discard CHAR  CHAR will toggle discarding of output\n\
-"), stdout);
-#endif
-#ifdef VDSUSP
-    fputs(_("\
- * dsusp CHAR    CHAR will send a terminal stop signal once input flushed\n\
-"), stdout);
-#endif
-    fputs(_("\
-   eof CHAR      CHAR will send an end of file (terminate the input)\n\
-   eol CHAR      CHAR will end the line\n\
-"), stdout);
-#ifdef VEOL2
-    fputs(_("\
- * eol2 CHAR     alternate CHAR for ending the line\n\
-"), stdout);
-#endif
-    fputs(_("\
-   erase CHAR    CHAR will erase the last character typed\n\
-   intr CHAR     CHAR will send an interrupt signal\n\
-   kill CHAR     CHAR will erase the current line\n\
-"), stdout);
-#ifdef VLNEXT
-    fputs(_("\
- * lnext CHAR    CHAR will enter the next character quoted\n\
-"), stdout);
-#endif
-#ifdef VSTATUS
-    fputs(_("\
- * status CHAR   CHAR will send an info signal\n\
-"), stdout);
-#endif
-    fputs(_("\
-   quit CHAR     CHAR will send a quit signal\n\
-"), stdout);
-#if defined CREPRINT || defined VREPRINT
-    fputs(_("\
- * rprnt CHAR    CHAR will redraw the current line\n\
-"), stdout);
-#endif
-    fputs(_("\
-   start CHAR    CHAR will restart the output after stopping it\n\
-   stop CHAR     CHAR will stop the output\n\
-   susp CHAR     CHAR will send a terminal stop signal\n\
-"), stdout);
-#ifdef VSWTCH
-    fputs(_("\
- * swtch CHAR    CHAR will switch to a different shell layer\n\
-"), stdout);
-#endif
-#ifdef VWERASE
-    fputs(_("\
- * werase CHAR   CHAR will erase the last word typed\n\
-"), stdout);
-#endif
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return ((intmax_t) (now.tv_sec - start->tv_sec) * 1000
+          + (now.tv_nsec - start->tv_nsec) / 1000000);
 }
 
-void print_special_settings(void)
+/* Return the milliseconds left until DEADLINE, or -1 if DEADLINE
+   is unset and we should wait forever.  */
+
+static int
+ms_until (struct timespec const *deadline)
 {
-    fputs(_("\
-\n\
-Special settings:\n\
-   N             set the input and output speeds to N bauds\n\
-"), stdout);
-#ifdef TIOCGWINSZ
-    fputs(_("\
-   cols N        tell the kernel that the terminal has N columns\n\
- * columns N     same as cols N\n\
-"), stdout);
-#endif
-    printf(_("\
- * [-]drain      wait for transmission before applying settings (%s by default)\
-\n"), tcsetattr_options == TCSADRAIN ? _("on") : _("off"));
-    fputs(_("\
-   ispeed N      set the input speed to N\n\
-"), stdout);
-#ifdef HAVE_C_LINE
-    fputs(_("\
- * line N        use line discipline N\n\
-"), stdout);
-#endif
-    fputs(_("\
-   min N         with -icanon, set N characters minimum for a completed read\n\
-   ospeed N      set the output speed to N\n\
-"), stdout);
-#ifdef TIOCGWINSZ
-    fputs(_("\
-   rows N        tell the kernel that the terminal has N rows\n\
-   size          print the number of rows and columns according to the kernel\n\
-"), stdout);
-#endif
-    fputs(_("\
-   speed         print the terminal speed\n\
-   time N        with -icanon, set read timeout of N tenths of a second\n\
-"), stdout);
+  if (deadline->tv_sec < 0)
+    return -1;
+
+  intmax_t ms = -ms_since (deadline);
+  return ms < 0 ? 0 : MIN (ms, INT_MAX);
 }
 
-void print_control_settings(void)
+/* Calls counted and timed by --stats.  */
+enum stat_call
+  {
+    stat_tcgetattr, stat_tcsetattr, stat_gwinsz, stat_swinsz, stat_ext,
+    stat_ioctl, stat_open, stat_fcntl, stat_lock, stat_drain, stat_n_calls
+  };
+
+static char const *const stat_call_name[stat_n_calls] =
 {
-    fputs(_("\
-\n\
-Control settings:\n\
-   [-]clocal     disable modem control signals\n\
-   [-]cread      allow input to be received\n\
-"), stdout);
-#ifdef CRTSCTS
-    fputs(_("\
- * [-]crtscts    enable RTS/CTS handshaking\n\
-"), stdout);
-#endif
-#ifdef CDTRDSR
-    fputs(_("\
- * [-]cdtrdsr    enable DTR/DSR handshaking\n\
-"), stdout);
-#endif
-    fputs(_("\
-   csN           set character size to N bits, N in [5..8]\n\
-"), stdout);
-    fputs(_("\
-   [-]cstopb     use two stop bits per character (one with '-')\n\
-   [-]hup        send a hangup signal when the last process closes the tty\n\
-   [-]hupcl      same as [-]hup\n\
-   [-]parenb     generate parity bit in output and expect parity bit in input\n\
-   [-]parodd     set odd parity (or even parity with '-')\n\
-"), stdout);
-#ifdef CMSPAR
-    fputs(_("\
- * [-]cmspar     use \"stick\" (mark/space) parity\n\
-"), stdout);
+  "tcgetattr", "tcsetattr", "ioctl(TIOCGWINSZ)", "ioctl(TIOCSWINSZ)",
+  "ioctl(TIOCEXT)", "ioctl(other)", "open", "fcntl", "flock", "drain"
+};
+
+/* Latency histogram buckets: bucket I counts calls that took
+   less than 2**I microseconds, the last one everything slower.  */
+enum { STAT_BUCKETS = 24 };
+
+struct call_stats
+  {
+    uintmax_t count;
+    intmax_t total_ns;
+    intmax_t max_ns;
+    uintmax_t hist[STAT_BUCKETS];
+  };
+
+/* The calls made on one device.  */
+struct device_stats
+  {
+    char const *name;
+    struct call_stats calls[stat_n_calls];
+    struct device_stats *next;
+  };
+
+/* The devices that --stats reports on, in the order they were first
+   used, and the one whose calls are being counted.  */
+static struct device_stats *stats_devices;
+static struct device_stats **stats_devices_end = &stats_devices;
+static struct device_stats *stats_device;
+
+/* Count the calls from now on as made on a new device NAME, if --stats
+   is in effect, and return its statistics, for switching back to it.  */
+
+static struct device_stats *
+stats_new_device (char const *name)
+{
+  if (!stats_output)
+    return nullptr;
+
+  struct device_stats *d = xzalloc (sizeof *d);
+  d->name = name;
+  *stats_devices_end = d;
+  stats_devices_end = &d->next;
+  stats_device = d;
+  return d;
+}
+
+/* Start timing a call, if --stats is in effect.  */
+
+static void
+stats_start (struct timespec *start)
+{
+  if (stats_output)
+    clock_gettime (CLOCK_MONOTONIC, start);
+}
+
+/* Account a call of kind CALL that started at START.  */
+
+static void
+stats_stop (enum stat_call call, struct timespec const *start)
+{
+  if (!stats_output)
+    return;
+
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  intmax_t ns = ((intmax_t) (now.tv_sec - start->tv_sec) * 1000000000
+                 + (now.tv_nsec - start->tv_nsec));
+  struct call_stats *cs = &stats_device->calls[call];
+  int bucket = 0;
+  for (intmax_t us = ns / 1000; us != 0 && bucket < STAT_BUCKETS - 1; us >>= 1)
+    bucket++;
+  cs->count++;
+  cs->total_ns += ns;
+  cs->max_ns = MAX (cs->max_ns, ns);
+  cs->hist[bucket]++;
+}
+
+/* Where terminal state is read and written.  Normally that is the
+   kernel, but the hidden ---fake-tty option substitutes a terminal kept
+   in memory, so the cost of parsing, changing and printing settings can
+   be measured without kernel noise, and drivers that ignore some flags
+   can be simulated.  Only the calls below go through it; features that
+   need a real device, such as flushing or modem lines, still do not.  */
+struct tty_backend
+{
+  int (*get_attr) (int fd, struct termios *mode);
+  int (*set_attr) (int fd, int action, struct termios const *mode);
+  int (*control) (int fd, unsigned long int request, void *arg);
+};
+
+static int
+kernel_control (int fd, unsigned long int request, void *arg)
+{
+  return ioctl (fd, request, arg);
+}
+
+static struct tty_backend const kernel_backend =
+{
+  tcgetattr, tcsetattr, kernel_control
+};
+
+/* The state of the ---fake-tty terminal, which every descriptor
+   refers to, and its faults.  */
+static struct
+{
+  struct termios mode;
+  struct winsize win;
+  tcflag_t reject[4];		/* Flag bits set_attr silently drops, in
+                                   the order iflag, oflag, cflag, lflag.  */
+  double latency;		/* Seconds each call takes.  */
+} fake_tty;
+
+static void
+fake_delay (void)
+{
+  if (fake_tty.latency)
+    xnanosleep (fake_tty.latency);
+}
+
+static int
+fake_get_attr (MAYBE_UNUSED int fd, struct termios *mode)
+{
+  fake_delay ();
+  *mode = fake_tty.mode;
+  return 0;
+}
+
+static int
+fake_set_attr (MAYBE_UNUSED int fd, MAYBE_UNUSED int action,
+               struct termios const *mode)
+{
+  fake_delay ();
+  fake_tty.mode = *mode;
+  fake_tty.mode.c_iflag &= ~fake_tty.reject[0];
+  fake_tty.mode.c_oflag &= ~fake_tty.reject[1];
+  fake_tty.mode.c_cflag &= ~fake_tty.reject[2];
+  fake_tty.mode.c_lflag &= ~fake_tty.reject[3];
+  return 0;
+}
+
+/* Support the window size; fail everything else as a device that
+   is not a serial port would.  */
+
+static int
+fake_control (MAYBE_UNUSED int fd, unsigned long int request, void *arg)
+{
+  fake_delay ();
+#ifdef TIOCGWINSZ
+  if (request == TIOCGWINSZ)
+    {
+      *(struct winsize *) arg = fake_tty.win;
+      return 0;
+    }
+  if (request == TIOCSWINSZ)
+    {
+      fake_tty.win = *(struct winsize const *) arg;
+      return 0;
+    }
 #endif
+  errno = ENOTTY;
+  return -1;
 }
 
-void print_input_settings(void)
+static struct tty_backend const fake_backend =
 {
-    fputs(_("\
-\n\
-Input settings:\n\
-   [-]brkint     breaks cause an interrupt signal\n\
-   [-]icrnl      translate carriage return to newline\n\
-   [-]ignbrk     ignore break characters\n\
-   [-]igncr      ignore carriage return\n\
-   [-]ignpar     ignore characters with parity errors\n\
-"), stdout);
-#ifdef IMAXBEL
-    fputs(_("\
- * [-]imaxbel    beep and do not flush a full input buffer on a character\n\
-"), stdout);
+  fake_get_attr, fake_set_attr, fake_control
+};
+
+static struct tty_backend const *backend = &kernel_backend;
+
+/* Store into *MODE the settings of a terminal that has no others to
+   report: sane, 8 bits at 38400 baud.  */
+
+static void
+default_mode (struct termios *mode)
+{
+  memset (mode, 0, sizeof *mode);
+  sane_mode (mode);
+  mode->c_cflag |= CS8 | CREAD;
+  cfsetispeed (mode, B38400);
+  cfsetospeed (mode, B38400);
+}
+
+/* Switch to the fake terminal, in sane mode at 38400 baud with 24 rows
+   and 80 columns, and apply the comma-separated OPTIONS: latency=US to
+   make each call take US microseconds, and reject-iflag=BITS,
+   reject-oflag=BITS, reject-cflag=BITS or reject-lflag=BITS to have
+   changes of those flag bits be silently ignored.  */
+
+static void
+use_fake_tty (char *options)
+{
+  static char const *const names[] =
+  {
+    "reject-iflag", "reject-oflag", "reject-cflag", "reject-lflag",
+    "latency", nullptr
+  };
+
+  backend = &fake_backend;
+  default_mode (&fake_tty.mode);
+#ifdef TIOCGWINSZ
+  fake_tty.win.ws_row = 24;
+  fake_tty.win.ws_col = 80;
+#endif
+
+  for (char *opt = options ? strtok (options, ",") : nullptr; opt;
+       opt = strtok (nullptr, ","))
+    {
+      char *value = strchr (opt, '=');
+      char *end;
+      int i = 0;
+      if (value)
+        {
+          *value++ = '\0';
+          while (names[i] && !STREQ (opt, names[i]))
+            i++;
+        }
+      errno = 0;
+      unsigned long int n = value ? strtoul (value, &end, 0) : 0;
+      if (!value || !names[i] || errno || end == value || *end
+          || (i < 4 && (tcflag_t) n != n))
+        error (EXIT_FAILURE, 0, _("invalid ---fake-tty option %s"),
+               quote (opt));
+      if (i < 4)
+        fake_tty.reject[i] = n;
+      else
+        fake_tty.latency = n / 1e6;
+    }
+}
+
+static int
+timed_tcgetattr (int fd, struct termios *mode)
+{
+  struct timespec start;
+  stats_start (&start);
+  int ret = backend->get_attr (fd, mode);
+  stats_stop (stat_tcgetattr, &start);
+  return ret;
+}
+
+static int
+timed_tcsetattr (int fd, int action, struct termios const *mode)
+{
+  struct timespec start;
+  stats_start (&start);
+  int ret = backend->set_attr (fd, action, mode);
+  stats_stop (stat_tcsetattr, &start);
+  return ret;
+}
+
+static int
+timed_ioctl (int fd, unsigned long int request, void *arg)
+{
+  struct timespec start;
+  enum stat_call call = stat_ioctl;
+#ifdef TIOCGWINSZ
+  if (request == TIOCGWINSZ)
+    call = stat_gwinsz;
+  else if (request == TIOCSWINSZ)
+    call = stat_swinsz;
+#endif
+#ifdef TIOCEXT
+  if (request == TIOCEXT)
+    call = stat_ext;
 #endif
+  stats_start (&start);
+  int ret = backend->control (fd, request, arg);
+  stats_stop (call, &start);
+  return ret;
+}
+
+static int
+timed_fcntl (int fd, int cmd, int arg)
+{
+  struct timespec start;
+  stats_start (&start);
+  int ret = fcntl (fd, cmd, arg);
+  stats_stop (stat_fcntl, &start);
+  return ret;
+}
+
+/* Output STR as a JSON string literal.  */
+
+static void
+json_string (FILE *stream, char const *str)
+{
+  putc ('"', stream);
+  for (unsigned char const *p = (unsigned char const *) str; *p; p++)
+    {
+      if (*p == '"' || *p == '\\')
+        fprintf (stream, "\\%c", *p);
+      else if (*p < 0x20)
+        fprintf (stream, "\\u%04x", *p);
+      else
+        putc (*p, stream);
+    }
+  putc ('"', stream);
+}
+
+/* Print the calls counted in CALLS to stderr, as the members of a JSON
+   object if AS_JSON, or else as lines of text.  */
+
+static void
+print_call_stats (struct call_stats const *calls, bool as_json)
+{
+  char const *sep = "";
+
+  for (int i = 0; i < stat_n_calls; i++)
+    {
+      struct call_stats const *cs = &calls[i];
+      if (cs->count == 0)
+        continue;
+
+      if (as_json)
+        {
+          fprintf (stderr, "%s\"%s\": {\"count\": %ju, \"total_ns\": %jd,"
+                   " \"max_ns\": %jd, \"histogram_us\": {",
+                   sep, stat_call_name[i], cs->count, cs->total_ns,
+                   cs->max_ns);
+          sep = ", ";
+        }
+      else
+        fprintf (stderr, "  %-18s %6ju %12.3f ms %10.3f ms max\n",
+                 stat_call_name[i], cs->count, cs->total_ns / 1e6,
+                 cs->max_ns / 1e6);
+
+      char const *hsep = "";
+      for (int b = 0; b < STAT_BUCKETS; b++)
+        {
+          if (cs->hist[b] == 0)
+            continue;
+          if (as_json)
+            {
+              if (b < STAT_BUCKETS - 1)
+                fprintf (stderr, "%s\"<%ju\": %ju", hsep,
+                         (uintmax_t) 1 << b, cs->hist[b]);
+              else
+                fprintf (stderr, "%s\"inf\": %ju", hsep, cs->hist[b]);
+              hsep = ", ";
+            }
+          else if (b < STAT_BUCKETS - 1)
+            fprintf (stderr, "    < %8ju us %6ju\n",
+                     (uintmax_t) 1 << b, cs->hist[b]);
+          else
+            fprintf (stderr, "    >=%8ju us %6ju\n",
+                     (uintmax_t) 1 << (b - 1), cs->hist[b]);
+        }
+      if (as_json)
+        fputs ("}}", stderr);
+    }
+}
+
+/* Print the --stats report to stderr: the calls made on each device
+   that had any, and with several such devices, their total.  With
+   --stats=json, each of these is a JSON object on a line of its own.
+   Registered with atexit, so it is also output when we exit due to
+   an error.  */
+
+static void
+print_stats (void)
+{
+  bool as_json = STREQ (stats_output, "json");
+  struct call_stats total[stat_n_calls] = { 0, };
+  int devices = 0;
+
+  for (struct device_stats const *d = stats_devices; d; d = d->next)
+    {
+      bool used = false;
+      for (int i = 0; i < stat_n_calls; i++)
+        {
+          struct call_stats const *cs = &d->calls[i];
+          used |= cs->count != 0;
+          total[i].count += cs->count;
+          total[i].total_ns += cs->total_ns;
+          total[i].max_ns = MAX (total[i].max_ns, cs->max_ns);
+          for (int b = 0; b < STAT_BUCKETS; b++)
+            total[i].hist[b] += cs->hist[b];
+        }
+      if (!used)
+        continue;
+      devices++;
+
+      if (as_json)
+        {
+          fputs ("{\"device\": ", stderr);
+          json_string (stderr, d->name);
+          fputs (", \"calls\": {", stderr);
+        }
+      else
+        fprintf (stderr, _("%s: call statistics for %s\n"),
+                 program_name, quotef (d->name));
+      print_call_stats (d->calls, as_json);
+      if (as_json)
+        fputs ("}}\n", stderr);
+    }
+
+  if (devices < 2)
+    return;
+  if (as_json)
+    fprintf (stderr, "{\"devices\": %d, \"calls\": {", devices);
+  else
+    fprintf (stderr, _("%s: call statistics for all %d devices\n"),
+             program_name, devices);
+  print_call_stats (total, as_json);
+  if (as_json)
+    fputs ("}}\n", stderr);
+}
+
+void print_usage_header(void)
+{
+    printf(_("\
+Usage: %s [-F DEVICE | --file=DEVICE] [SETTING]...\n\
+  or:  %s [-F DEVICE | --file=DEVICE] [-a|--all]\n\
+  or:  %s [-F DEVICE | --file=DEVICE] [-g|--save]\n\
+  or:  %s [-F DEVICE | --file=DEVICE] --json|--bench\n\
+  or:  %s [-F DEVICE | --file=DEVICE] --fingerprint [--fields=LIST]\n\
+  or:  %s [-F DEVICE | --file=DEVICE] --wait-size|--watch-size [--timeout=MS]\n\
+  or:  %s [-F DEVICE | --file=DEVICE] --wait-modem=LINES [--timeout=MS]\n\
+  or:  %s [-F DEVICE | --file=DEVICE] --probe-size [--timeout=MS]\n\
+  or:  %s [-F DEVICE | --file=DEVICE] --undo[=N]|--history\n\
+  or:  %s --openpty=N [--run=COMMAND] [SETTING]...\n\
+  or:  %s --rfc2217=HOST:PORT[,HOST:PORT]... [-a|-g|SETTING...]\n\
+  or:  %s [-F DEVICE | --file=DEVICE] --broadcast-size[=ROWSxCOLS]\n\
+                [--stagger=MS] DEVICE...\n\
+  or:  %s [-F DEVICE | --file=DEVICE] --watch-queue=MS [--timeout=MS]\n\
+                [DEVICE]...\n\
+  or:  %s [-F DEVICE | --file=DEVICE] --watch-icount=MS [--timeout=MS]\n\
+                [--json]\n\
+"),
+            program_name, program_name, program_name, program_name,
+            program_name, program_name, program_name, program_name,
+            program_name, program_name, program_name, program_name,
+            program_name, program_name);
     fputs(_("\
-   [-]inlcr      translate newline to carriage return\n\
-   [-]inpck      enable input parity checking\n\
-   [-]istrip     clear high (8th) bit of input characters\n\
+Print or change terminal characteristics.\n\
 "), stdout);
-#ifdef IUTF8
+    emit_mandatory_arg_note();
     fputs(_("\
- * [-]iutf8      assume input characters are UTF-8 encoded\n\
+  -a, --all          print all current settings in human-readable form\n\
+  -g, --save         print all current settings in a stty-readable form\n\
+  -F, --file=DEVICE  open and use DEVICE instead of standard input\n\
 "), stdout);
-#endif
-#ifdef IUCLC
     fputs(_("\
- * [-]iuclc      translate uppercase characters to lowercase\n\
+      --json         print all current settings as a JSON object\n\
+      --bench        measure the input and output rate of a local pty\n\
+                     with the current settings applied\n\
+      --fingerprint  print a 64-bit hash of the current settings, which\n\
+                     is the same for devices configured alike\n\
+      --fields=LIST  with --fingerprint, hash only the comma-separated\n\
+                     parts cflag, iflag, oflag, lflag, cc and speed\n\
+                     (default all)\n\
 "), stdout);
-#endif
-#ifdef IXANY
     fputs(_("\
- * [-]ixany      let any character restart output, not only start character\n\
+      --broadcast-size[=ROWSxCOLS]  give each DEVICE operand the window\n\
+                     size ROWSxCOLS, or by default that of the terminal\n\
+      --stagger=MS   with --broadcast-size, spread the changes, and so the\n\
+                     SIGWINCH signals they cause, evenly over MS milliseconds\n\
+      --drain-timeout=MS  wait at most MS milliseconds for output to drain\n\
+                     before applying settings\n\
+      --drain-policy=POLICY  if output did not drain in time: 'now' applies\n\
+                     the settings anyway (default), 'flush' discards pending\n\
+                     input and output first, 'fail' exits with an error\n\
+      --lock[=MS]    hold an advisory lock on the device from reading the\n\
+                     settings until they are applied and verified, waiting\n\
+                     at most MS milliseconds for other holders\n\
+      --rfc2217=HOST:PORT  use the serial port behind each comma-separated\n\
+                     terminal server address, through the RFC 2217 Telnet\n\
+                     COM-PORT-OPTION, instead of a local device; only the\n\
+                     speed, character size, parity, stop bits, flow control,\n\
+                     dtr and rts can be changed, and speed 0 drops dtr\n\
+      --openpty=N    create N ptys and apply the SETTINGs to each; then\n\
+                     print their names and keep them open until killed,\n\
+                     or run COMMAND\n\
+      --run=COMMAND  with --openpty, run COMMAND with the shell, with the\n\
+                     masters open and their descriptors and the pty names\n\
+                     in $STTY_PTY_MASTERS and $STTY_PTY_NAMES; exit with\n\
+                     its status\n\
+      --modem-order=WHEN  change modem control lines 'before' or 'after'\n\
+                     (default) applying the other settings\n\
+      --stats[=FORMAT]  count and time terminal system calls, and report\n\
+                     them per device, and in total for several devices,\n\
+                     on stderr as FORMAT 'text' (default) or 'json'\n\
+      --wait-modem=LINES  wait for a change of any of the comma-separated\n\
+                     modem input LINES cts, dsr, cd and ri, then print\n\
+                     the modem control lines\n\
+      --probe-size   ask the terminal at the other end of the line for its\n\
+                     size, then tell the kernel and print it as 'size' does\n\
+      --wait-size    wait for the window size to change, then print it\n\
+      --watch-size   print the window size each time it changes\n\
+      --watch-queue=MS  every MS milliseconds, print the number of bytes\n\
+                     in the input and output queues of each DEVICE\n\
+      --watch-icount=MS  every MS milliseconds, print how much the UART\n\
+                     byte and error counters grew, and the error rate\n\
+      --timeout=MS   stop waiting or watching after MS milliseconds; with\n\
+                     --rfc2217, wait at most MS milliseconds for the\n\
+                     connections and for each round of replies of the\n\
+                     terminal servers (default 5000)\n\
+      --undo[=N]     restore the settings and window size the device had\n\
+                     before the Nth most recent change (default 1)\n\
+      --history      list the saved settings that --undo can restore\n\
 "), stdout);
-#endif
+    fputs(HELP_OPTION_DESCRIPTION, stdout);
+    fputs(VERSION_OPTION_DESCRIPTION, stdout);
     fputs(_("\
-   [-]ixoff      enable sending of start/stop characters\n\
-   [-]ixon       enable XON/XOFF flow control\n\
-   [-]parmrk     mark parity errors (with a 255-0-character sequence)\n\
-   [-]tandem     same as [-]ixoff\n\
+\n\
+Optional - before SETTING indicates negation.  An * marks non-POSIX\n\
+settings.  The underlying system defines which settings are available.\n\
 "), stdout);
 }
 
-void print_output_settings(void)
+void print_special_characters(void)
 {
     fputs(_("\
 \n\
-Output settings:\n\
-"), stdout);
-#ifdef BSDLY
+Special characters:\n"), stdout);
+#ifdef VFLUSHO
     fputs(_("\
- * bsN           backspace delay style, N in [0..1]\n\
+ * discard CHAR  CHAR will toggle discarding of output\n\
 "), stdout);
 #endif
-#ifdef CRDLY
+#ifdef VDSUSP
     fputs(_("\
- * crN           carriage return delay style, N in [0..3]\n\
+ * dsusp CHAR    CHAR will send a terminal stop signal once input flushed\n\
 "), stdout);
 #endif
-#ifdef FFDLY
     fputs(_("\
- * ffN           form feed delay style, N in [0..1]\n\
+   eof CHAR      CHAR will send an end of file (terminate the input)\n\
+   eol CHAR      CHAR will end the line\n\
 "), stdout);
-#endif
-#ifdef NLDLY
+#ifdef VEOL2
     fputs(_("\
- * nlN           newline delay style, N in [0..1]\n\
+ * eol2 CHAR     alternate CHAR for ending the line\n\
 "), stdout);
 #endif
-#ifdef OCRNL
     fputs(_("\
- * [-]ocrnl      translate carriage return to newline\n\
+   erase CHAR    CHAR will erase the last character typed\n\
+   intr CHAR     CHAR will send an interrupt signal\n\
+   kill CHAR     CHAR will erase the current line\n\
 "), stdout);
-#endif
-#ifdef OFDEL
+#ifdef VLNEXT
     fputs(_("\
- * [-]ofdel      use delete characters for fill instead of NUL characters\n\
+ * lnext CHAR    CHAR will enter the next character quoted\n\
 "), stdout);
 #endif
-#ifdef OFILL
+#ifdef VSTATUS
     fputs(_("\
- * [-]ofill      use fill (padding) characters instead of timing for delays\n\
+ * status CHAR   CHAR will send an info signal\n\
 "), stdout);
 #endif
-#ifdef OLCUC
     fputs(_("\
- * [-]olcuc      translate lowercase characters to uppercase\n\
+   quit CHAR     CHAR will send a quit signal\n\
 "), stdout);
-#endif
-#ifdef ONLCR
+#if defined CREPRINT || defined VREPRINT
     fputs(_("\
- * [-]onlcr      translate newline to carriage return-newline\n\
+ * rprnt CHAR    CHAR will redraw the current line\n\
 "), stdout);
 #endif
-#ifdef ONLRET
     fputs(_("\
- * [-]onlret     newline performs a carriage return\n\
+   start CHAR    CHAR will restart the output after stopping it\n\
+   stop CHAR     CHAR will stop the output\n\
+   susp CHAR     CHAR will send a terminal stop signal\n\
 "), stdout);
-#endif
-#ifdef ONOCR
+#ifdef VSWTCH
     fputs(_("\
- * [-]onocr      do not print carriage returns in the first column\n\
+ * swtch CHAR    CHAR will switch to a different shell layer\n\
+"), stdout);
+#endif
+#ifdef VWERASE
+    fputs(_("\
+ * werase CHAR   CHAR will erase the last word typed\n\
+"), stdout);
+#endif
+}
+
+void print_special_settings(void)
+{
+    fputs(_("\
+\n\
+Special settings:\n\
+   N             set the input and output speeds to N bauds\n\
+"), stdout);
+#ifdef TIOCGWINSZ
+    fputs(_("\
+   cols N        tell the kernel that the terminal has N columns\n\
+ * columns N     same as cols N\n\
+"), stdout);
+#endif
+#if USE_TIOCSSERIAL
+    fputs(_("\
+ * close_delay N  have the UART driver keep the modem control lines low for\n\
+                 N milliseconds after close, before the device can be reopened\n\
+ * closing_wait N  have close wait at most N milliseconds for output to\n\
+                 drain; N may be 'none' (or 0) to not wait, or 'infinite'\n\
+"), stdout);
+#endif
+    fputs(_("\
+ * batch N       with -icanon, set min so reads return once N characters\n\
+                 have arrived\n\
+"), stdout);
+    printf(_("\
+ * [-]drain      wait for transmission before applying settings (%s by default)\
+\n"), tcsetattr_options == TCSADRAIN ? _("on") : _("off"));
+    fputs(_("\
+ * drainflush    like drain, but also discard unread input when applying\n\
+ * [-]dtr        raise the DTR modem control line\n\
+"), stdout);
+#if defined TIOCEXCL && defined TIOCNXCL
+    fputs(_("\
+ * [-]excl       refuse further opens of the device, except by root\n\
+"), stdout);
+#endif
+    fputs(_("\
+ * iflush        discard unread input, after applying settings\n\
+ * ioff          send a STOP character, before applying settings\n\
+ * ioflush       same as iflush oflush\n\
+ * ion           send a START character, after applying settings\n\
+   ispeed N      set the input speed to N\n\
+ * latency N     with -icanon, set min and time from the speed and character\n\
+                 format, so reads return about N milliseconds after input\n\
+                 stops, or once N milliseconds worth of input has arrived\n\
+"), stdout);
+#ifdef HAVE_C_LINE
+    fputs(_("\
+ * line N        use line discipline N\n\
+"), stdout);
+#endif
+#if USE_TIOCSSERIAL
+    fputs(_("\
+ * [-]low_latency  have the UART driver pass on input without batching it\n\
+"), stdout);
+#endif
+    fputs(_("\
+   min N         with -icanon, set N characters minimum for a completed read\n\
+ * modem         print the state of the modem control lines\n\
+ * oflush        discard unsent output, before applying settings\n\
+ * ooff          suspend output, after applying settings\n\
+ * oon           resume suspended output, after applying settings\n\
+   ospeed N      set the output speed to N\n\
+"), stdout);
+#ifdef TIOCGWINSZ
+    fputs(_("\
+   rows N        tell the kernel that the terminal has N rows\n\
+   size          print the number of rows and columns according to the kernel\n\
+"), stdout);
+#endif
+    fputs(_("\
+ * [-]rts        raise the RTS modem control line\n\
+"), stdout);
+#if USE_TIOCSRS485
+    fputs(_("\
+ * [-]rs485      drive the line as half-duplex RS-485, switching the\n\
+                 transmitter with RTS\n\
+ * [-]rts_after_send  with rs485, hold RTS high once done sending\n\
+ * rts_delay_after N  with rs485, keep the transmitter on for N\n\
+                 milliseconds after sending\n\
+ * rts_delay_before N  with rs485, turn the transmitter on N\n\
+                 milliseconds before sending\n\
+ * [-]rts_on_send  with rs485, hold RTS high while sending\n\
+ * [-]rx_during_tx  with rs485, keep receiving while sending\n\
+"), stdout);
+#endif
+    fputs(_("\
+   speed         print the terminal speed\n\
+ * icount        print the UART byte and error counters\n\
+ * queue         print the number of bytes in the input and output queues\n\
+ * throughput    print the characters and data bytes per second the speed\n\
+                 and character format allow, and the characters of text\n\
+                 per second in 80-column lines when opost and onlcr send\n\
+                 each newline as two characters\n\
+   time N        with -icanon, set read timeout of N tenths of a second\n\
+"), stdout);
+#if USE_TIOCSSERIAL
+    fputs(_("\
+ * xmit_fifo_size N  tell the UART driver its transmit FIFO holds N bytes\n\
+"), stdout);
+#endif
+}
+
+void print_control_settings(void)
+{
+    fputs(_("\
+\n\
+Control settings:\n\
+   [-]clocal     disable modem control signals\n\
+   [-]cread      allow input to be received\n\
+"), stdout);
+#ifdef CRTSCTS
+    fputs(_("\
+ * [-]crtscts    enable RTS/CTS handshaking\n\
+"), stdout);
+#endif
+#ifdef CDTRDSR
+    fputs(_("\
+ * [-]cdtrdsr    enable DTR/DSR handshaking\n\
+"), stdout);
+#endif
+    fputs(_("\
+   csN           set character size to N bits, N in [5..8]\n\
+"), stdout);
+    fputs(_("\
+   [-]cstopb     use two stop bits per character (one with '-')\n\
+   [-]hup        send a hangup signal when the last process closes the tty\n\
+   [-]hupcl      same as [-]hup\n\
+   [-]parenb     generate parity bit in output and expect parity bit in input\n\
+   [-]parodd     set odd parity (or even parity with '-')\n\
+"), stdout);
+#ifdef CMSPAR
+    fputs(_("\
+ * [-]cmspar     use \"stick\" (mark/space) parity\n\
+"), stdout);
+#endif
+}
+
+void print_input_settings(void)
+{
+    fputs(_("\
+\n\
+Input settings:\n\
+   [-]brkint     breaks cause an interrupt signal\n\
+   [-]icrnl      translate carriage return to newline\n\
+   [-]ignbrk     ignore break characters\n\
+   [-]igncr      ignore carriage return\n\
+   [-]ignpar     ignore characters with parity errors\n\
+"), stdout);
+#ifdef IMAXBEL
+    fputs(_("\
+ * [-]imaxbel    beep and do not flush a full input buffer on a character\n\
+"), stdout);
+#endif
+    fputs(_("\
+   [-]inlcr      translate newline to carriage return\n\
+   [-]inpck      enable input parity checking\n\
+   [-]istrip     clear high (8th) bit of input characters\n\
+"), stdout);
+#ifdef IUTF8
+    fputs(_("\
+ * [-]iutf8      assume input characters are UTF-8 encoded\n\
+"), stdout);
+#endif
+#ifdef IUCLC
+    fputs(_("\
+ * [-]iuclc      translate uppercase characters to lowercase\n\
+"), stdout);
+#endif
+#ifdef IXANY
+    fputs(_("\
+ * [-]ixany      let any character restart output, not only start character\n\
+"), stdout);
+#endif
+    fputs(_("\
+   [-]ixoff      enable sending of start/stop characters\n\
+   [-]ixon       enable XON/XOFF flow control\n\
+   [-]parmrk     mark parity errors (with a 255-0-character sequence)\n\
+   [-]tandem     same as [-]ixoff\n\
+"), stdout);
+}
+
+void print_output_settings(void)
+{
+    fputs(_("\
+\n\
+Output settings:\n\
+"), stdout);
+#ifdef BSDLY
+    fputs(_("\
+ * bsN           backspace delay style, N in [0..1]\n\
+"), stdout);
+#endif
+#ifdef CRDLY
+    fputs(_("\
+ * crN           carriage return delay style, N in [0..3]\n\
+"), stdout);
+#endif
+#ifdef FFDLY
+    fputs(_("\
+ * ffN           form feed delay style, N in [0..1]\n\
+"), stdout);
+#endif
+#ifdef NLDLY
+    fputs(_("\
+ * nlN           newline delay style, N in [0..1]\n\
+"), stdout);
+#endif
+#ifdef OCRNL
+    fputs(_("\
+ * [-]ocrnl      translate carriage return to newline\n\
+"), stdout);
+#endif
+#ifdef OFDEL
+    fputs(_("\
+ * [-]ofdel      use delete characters for fill instead of NUL characters\n\
+"), stdout);
+#endif
+#ifdef OFILL
+    fputs(_("\
+ * [-]ofill      use fill (padding) characters instead of timing for delays\n\
+"), stdout);
+#endif
+#ifdef OLCUC
+    fputs(_("\
+ * [-]olcuc      translate lowercase characters to uppercase\n\
+"), stdout);
+#endif
+#ifdef ONLCR
+    fputs(_("\
+ * [-]onlcr      translate newline to carriage return-newline\n\
+"), stdout);
+#endif
+#ifdef ONLRET
+    fputs(_("\
+ * [-]onlret     newline performs a carriage return\n\
+"), stdout);
+#endif
+#ifdef ONOCR
+    fputs(_("\
+ * [-]onocr      do not print carriage returns in the first column\n\
 "), stdout);
 #endif
     fputs(_("\
@@ -1224,6 +2215,45 @@ static bool process_drain_setting(char const *arg, bool reversed) {
         tcsetattr_options = reversed ? TCSANOW : TCSADRAIN;
         return true;
     }
+    /* Plain "flush" is taken by the deprecated name of "discard".  */
+    if (STREQ(arg, "drainflush") && !reversed) {
+        tcsetattr_options = TCSAFLUSH;
+        return true;
+    }
+    return false;
+}
+
+#if USE_TIOCM
+static bool process_modem_setting(char const *arg, bool reversed) {
+    int bit;
+    if (STREQ(arg, "dtr")) {
+        bit = TIOCM_DTR;
+    } else if (STREQ(arg, "rts")) {
+        bit = TIOCM_RTS;
+    } else {
+        return false;
+    }
+    if (reversed) {
+        modem_clear |= bit;
+        modem_set &= ~bit;
+    } else {
+        modem_set |= bit;
+        modem_clear &= ~bit;
+    }
+    return true;
+}
+#endif
+
+static bool process_tty_action(char const *arg, bool reversed) {
+    if (reversed) {
+        return false;
+    }
+    for (int i = 0; tty_action_info[i].name != nullptr; ++i) {
+        if (STREQ(arg, tty_action_info[i].name)) {
+            tty_actions |= tty_action_info[i].actions;
+            return true;
+        }
+    }
     return false;
 }
 
@@ -1280,7 +2310,7 @@ static void handle_extproc(char const *arg, bool reversed, bool checking, char c
     if (STREQ(arg, "extproc")) {
         if (!checking) {
             int val = !reversed;
-            if (ioctl(STDIN_FILENO, TIOCEXT, &val) != 0) {
+            if (timed_ioctl(STDIN_FILENO, TIOCEXT, &val) != 0) {
                 error(EXIT_FAILURE, errno, _("%s: error setting %s"),
                      quotef_n(0, device_name), quote_n(1, arg));
             }
@@ -1289,6 +2319,20 @@ static void handle_extproc(char const *arg, bool reversed, bool checking, char c
 }
 #endif
 
+#if defined TIOCEXCL && defined TIOCNXCL
+static bool handle_exclusive(char const *arg, bool reversed, bool checking, char const *device_name) {
+    if (!STREQ(arg, "excl")) {
+        return false;
+    }
+    if (!checking
+        && timed_ioctl(STDIN_FILENO, reversed ? TIOCNXCL : TIOCEXCL, nullptr) != 0) {
+        error(EXIT_FAILURE, errno, _("%s: error setting %s"),
+              quotef_n(0, device_name), quote_n(1, arg));
+    }
+    return true;
+}
+#endif
+
 #ifdef TIOCGWINSZ
 static int handle_window_size(char const *arg, int k, int n_settings, char * const *settings,
                               bool checking, char const *device_name) {
@@ -1321,26 +2365,240 @@ static int handle_window_size(char const *arg, int k, int n_settings, char * con
 }
 #endif
 
-#ifdef HAVE_C_LINE
-static int handle_line_discipline(char const *arg, int k, int n_settings, char * const *settings,
-                                  struct termios *mode, bool *require_set_attr) {
-    if (STREQ(arg, "line")) {
-        validate_argument_exists(arg, k, n_settings, settings);
-        uintmax_t value = integer_arg(settings[k + 1], UINTMAX_MAX);
-        if (ckd_add(&mode->c_line, value, 0)) {
-            error(0, EOVERFLOW, _("invalid line discipline %s"), quote(settings[k + 1]));
-        }
-        *require_set_attr = true;
-        return 1;
+#if USE_TIOCSSERIAL
+/* UART driver settings, read on first use by a setting and written
+   back once after all settings have been processed.  */
+static struct serial_struct serial_info;
+static bool serial_info_read;
+static bool serial_info_changed;
+
+static void get_serial_info(char const *device_name) {
+    if (serial_info_read) {
+        return;
     }
-    return -1;
+    if (timed_ioctl(STDIN_FILENO, TIOCGSERIAL, &serial_info) != 0) {
+        error(EXIT_FAILURE, errno, _("%s: cannot get serial driver settings"),
+              quotef(device_name));
+    }
+    serial_info_read = true;
 }
-#endif
 
-static void apply_settings(bool checking, char const *device_name,
-                          char * const *settings, int n_settings,
-                          struct termios *mode, bool *require_set_attr) {
-    for (int k = 1; k < n_settings; k++) {
+static int handle_serial_setting(char const *arg, bool reversed, int k, int n_settings,
+                                 char * const *settings, bool checking,
+                                 char const *device_name) {
+    if (STREQ(arg, "low_latency")) {
+        if (!checking) {
+            get_serial_info(device_name);
+            if (reversed) {
+                serial_info.flags &= ~ASYNC_LOW_LATENCY;
+            } else {
+                serial_info.flags |= ASYNC_LOW_LATENCY;
+            }
+            serial_info_changed = true;
+        }
+        return 0;
+    }
+
+    if (reversed) {
+        return -1;
+    }
+
+    if (STREQ(arg, "xmit_fifo_size")) {
+        validate_argument_exists(arg, k, n_settings, settings);
+        int value = integer_arg(settings[k + 1], INT_MAX);
+        if (!checking) {
+            get_serial_info(device_name);
+            serial_info.xmit_fifo_size = value;
+            serial_info_changed = true;
+        }
+        return 1;
+    }
+
+    if (STREQ(arg, "close_delay")) {
+        validate_argument_exists(arg, k, n_settings, settings);
+        /* The driver counts in hundredths of a second; round up.  */
+        int value = (integer_arg(settings[k + 1], USHRT_MAX * 10) + 9) / 10;
+        if (!checking) {
+            get_serial_info(device_name);
+            serial_info.close_delay = value;
+            serial_info_changed = true;
+        }
+        return 1;
+    }
+
+    if (STREQ(arg, "closing_wait")) {
+        validate_argument_exists(arg, k, n_settings, settings);
+        char const *s = settings[k + 1];
+        int value;
+        if (STREQ(s, "none")) {
+            value = ASYNC_CLOSING_WAIT_NONE;
+        } else if (STREQ(s, "infinite")) {
+            value = ASYNC_CLOSING_WAIT_INF;
+        } else {
+            value = (integer_arg(s, (ASYNC_CLOSING_WAIT_NONE - 1) * 10) + 9) / 10;
+            /* A zero wait would mean an infinite one to the driver.  */
+            if (value == 0) {
+                value = ASYNC_CLOSING_WAIT_NONE;
+            }
+        }
+        if (!checking) {
+            get_serial_info(device_name);
+            serial_info.closing_wait = value;
+            serial_info_changed = true;
+        }
+        return 1;
+    }
+
+    return -1;
+}
+
+static void set_serial_info(char const *device_name) {
+    if (serial_info_changed
+        && timed_ioctl(STDIN_FILENO, TIOCSSERIAL, &serial_info) != 0) {
+        error(EXIT_FAILURE, errno, _("%s: cannot set serial driver settings"),
+              quotef(device_name));
+    }
+}
+#endif
+
+#if USE_TIOCSRS485
+/* RS-485 settings, read on first use by a setting and written back
+   after all settings have been processed if they differ.  A device
+   without RS-485 support reads as having it off, with rs485_unsupported
+   set to the error; writing is skipped when nothing changed, so that
+   "-rs485" works on such devices.  */
+static struct serial_rs485 rs485_info;
+static struct serial_rs485 rs485_orig;
+static bool rs485_info_read;
+static int rs485_unsupported;
+
+static struct
+{
+  char const *name;
+  uint32_t flag;
+} const rs485_flags[] =
+{
+  {"rs485", SER_RS485_ENABLED},
+  {"rts_on_send", SER_RS485_RTS_ON_SEND},
+  {"rts_after_send", SER_RS485_RTS_AFTER_SEND},
+  {"rx_during_tx", SER_RS485_RX_DURING_TX},
+};
+
+/* The flags in rs485_flags.  */
+#define RS485_FLAGS (SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND \
+                     | SER_RS485_RTS_AFTER_SEND | SER_RS485_RX_DURING_TX)
+
+/* Read the RS-485 settings, if not done yet.  Fail if the device has
+   none, unless only CLEARING flags, which are then already clear.  */
+static void get_rs485_info(char const *device_name, bool clearing) {
+    if (!rs485_info_read) {
+        rs485_unsupported = 0;
+        if (timed_ioctl(STDIN_FILENO, TIOCGRS485, &rs485_info) != 0) {
+            if (errno != ENOTTY && errno != EINVAL) {
+                error(EXIT_FAILURE, errno, _("%s: cannot get RS-485 settings"),
+                      quotef(device_name));
+            }
+            rs485_unsupported = errno;
+            memset(&rs485_info, 0, sizeof rs485_info);
+        }
+        rs485_orig = rs485_info;
+        rs485_info_read = true;
+    }
+    if (rs485_unsupported && !clearing) {
+        error(EXIT_FAILURE, rs485_unsupported,
+              _("%s: cannot get RS-485 settings"), quotef(device_name));
+    }
+}
+
+/* Restore the RS-485 settings at the end of ARG, a -g string, if any.
+   A device without RS-485 support already has them as saved if they
+   were off.  */
+static void recover_rs485(char const *arg, char const *device_name) {
+    char const *fields = rs485_fields(arg);
+    struct serial_rs485 saved;
+    if (!fields || !parse_rs485(fields, &saved)) {
+        return;
+    }
+    get_rs485_info(device_name, !(saved.flags & RS485_FLAGS));
+    if (rs485_unsupported) {
+        return;
+    }
+    rs485_info.flags = (rs485_info.flags & ~RS485_FLAGS) | saved.flags;
+    rs485_info.delay_rts_before_send = saved.delay_rts_before_send;
+    rs485_info.delay_rts_after_send = saved.delay_rts_after_send;
+}
+
+static int handle_rs485_setting(char const *arg, bool reversed, int k, int n_settings,
+                                char * const *settings, bool checking,
+                                char const *device_name) {
+    for (int i = 0; i < countof(rs485_flags); ++i) {
+        if (STREQ(arg, rs485_flags[i].name)) {
+            if (!checking) {
+                get_rs485_info(device_name, reversed);
+                if (reversed) {
+                    rs485_info.flags &= ~rs485_flags[i].flag;
+                } else {
+                    rs485_info.flags |= rs485_flags[i].flag;
+                }
+            }
+            return 0;
+        }
+    }
+
+    if (reversed) {
+        return -1;
+    }
+
+    bool before = STREQ(arg, "rts_delay_before");
+    if (before || STREQ(arg, "rts_delay_after")) {
+        validate_argument_exists(arg, k, n_settings, settings);
+        uint32_t value = integer_arg(settings[k + 1], UINT32_MAX);
+        if (!checking) {
+            get_rs485_info(device_name, false);
+            if (before) {
+                rs485_info.delay_rts_before_send = value;
+            } else {
+                rs485_info.delay_rts_after_send = value;
+            }
+        }
+        return 1;
+    }
+
+    return -1;
+}
+
+static void set_rs485_info(char const *device_name) {
+    if (rs485_info_read
+        && (rs485_info.flags != rs485_orig.flags
+            || rs485_info.delay_rts_before_send != rs485_orig.delay_rts_before_send
+            || rs485_info.delay_rts_after_send != rs485_orig.delay_rts_after_send)
+        && timed_ioctl(STDIN_FILENO, TIOCSRS485, &rs485_info) != 0) {
+        error(EXIT_FAILURE, errno, _("%s: cannot set RS-485 settings"),
+              quotef(device_name));
+    }
+}
+#endif
+
+#ifdef HAVE_C_LINE
+static int handle_line_discipline(char const *arg, int k, int n_settings, char * const *settings,
+                                  struct termios *mode, bool *require_set_attr) {
+    if (STREQ(arg, "line")) {
+        validate_argument_exists(arg, k, n_settings, settings);
+        uintmax_t value = integer_arg(settings[k + 1], UINTMAX_MAX);
+        if (ckd_add(&mode->c_line, value, 0)) {
+            error(0, EOVERFLOW, _("invalid line discipline %s"), quote(settings[k + 1]));
+        }
+        *require_set_attr = true;
+        return 1;
+    }
+    return -1;
+}
+#endif
+
+static void apply_settings(bool checking, char const *device_name,
+                          char * const *settings, int n_settings,
+                          struct termios *mode, bool *require_set_attr) {
+    for (int k = 1; k < n_settings; k++) {
         char const *arg = settings[k];
         
         if (!arg) {
@@ -1356,19 +2614,70 @@ static void apply_settings(bool checking, char const *device_name,
         if (process_drain_setting(arg, reversed)) {
             continue;
         }
+
+        if (process_tty_action(arg, reversed)) {
+            continue;
+        }
+
+#if USE_TIOCM
+        if (process_modem_setting(arg, reversed)) {
+            continue;
+        }
+#endif
+
+#if defined TIOCEXCL && defined TIOCNXCL
+        if (handle_exclusive(arg, reversed, checking, device_name)) {
+            continue;
+        }
+#endif
         
         bool match_found = process_mode_info(arg, reversed, mode, require_set_attr);
         
-        if (!match_found && reversed) {
+        if (match_found) {
+#ifdef TIOCEXT
+            handle_extproc(arg, reversed, checking, device_name);
+#endif
+            continue;
+        }
+        
+#if USE_TIOCSSERIAL
+        int serial_result = handle_serial_setting(arg, reversed, k, n_settings, settings,
+                                                  checking, device_name);
+        if (serial_result >= 0) {
+            k += serial_result;
+            continue;
+        }
+#endif
+
+#if USE_TIOCSRS485
+        int rs485_result = handle_rs485_setting(arg, reversed, k, n_settings, settings,
+                                                checking, device_name);
+        if (rs485_result >= 0) {
+            k += rs485_result;
+            continue;
+        }
+#endif
+        
+        if (reversed) {
             handle_invalid_argument(arg, reversed);
         }
         
-        if (!match_found) {
-            int consumed = process_control_info(arg, k, n_settings, settings, mode, require_set_attr);
-            if (consumed > 0) {
-                k += consumed;
-                continue;
+        int consumed = process_control_info(arg, k, n_settings, settings, mode, require_set_attr);
+        if (consumed > 0) {
+            k += consumed;
+            continue;
+        }
+        
+        if (STREQ(arg, "latency") || STREQ(arg, "batch")) {
+            validate_argument_exists(arg, k, n_settings, settings);
+            if (STREQ(arg, "latency")) {
+                read_latency = integer_arg(settings[k + 1], INT_MAX);
+            } else {
+                read_batch = integer_arg(settings[k + 1], TYPE_MAXIMUM(cc_t));
             }
+            *require_set_attr = true;
+            k++;
+            continue;
         }
         
         if (STREQ(arg, "ispeed")) {
@@ -1383,10 +2692,6 @@ static void apply_settings(bool checking, char const *device_name,
             continue;
         }
         
-#ifdef TIOCEXT
-        handle_extproc(arg, reversed, checking, device_name);
-#endif
-        
 #ifdef TIOCGWINSZ
         int window_result = handle_window_size(arg, k, n_settings, settings, checking, device_name);
         if (window_result >= 0) {
@@ -1411,6 +2716,40 @@ static void apply_settings(bool checking, char const *device_name,
             continue;
         }
         
+        if (STREQ(arg, "icount")) {
+            if (!checking) {
+                max_col = screen_columns();
+                current_col = 0;
+                display_icount(false, device_name);
+            }
+            continue;
+        }
+        
+        if (STREQ(arg, "modem")) {
+            if (!checking) {
+                max_col = screen_columns();
+                current_col = 0;
+                display_modem(false, device_name);
+            }
+            continue;
+        }
+        
+        if (STREQ(arg, "queue")) {
+            if (!checking) {
+                max_col = screen_columns();
+                display_queue(false, device_name);
+            }
+            continue;
+        }
+        
+        if (STREQ(arg, "throughput")) {
+            if (!checking) {
+                max_col = screen_columns();
+                display_throughput(mode, false);
+            }
+            continue;
+        }
+        
         if (string_to_baud(arg) != (speed_t) -1) {
             set_speed(both_speeds, arg, mode);
             if (!checking) {
@@ -1422,192 +2761,2054 @@ static void apply_settings(bool checking, char const *device_name,
         if (!recover_mode(arg, mode)) {
             handle_invalid_argument(arg, false);
         }
+#if USE_TIOCSRS485
+        if (!checking) {
+            recover_rs485(arg, device_name);
+        }
+#endif
         *require_set_attr = true;
     }
     
+    set_read_timing(mode);
+    
     if (checking) {
         check_speed(mode);
     }
+    else {
+#if USE_TIOCSSERIAL
+        set_serial_info(device_name);
+#endif
+#if USE_TIOCSRS485
+        set_rs485_info(device_name);
+#endif
+    }
+}
+
+/* Set up message translation.  This is deferred by the fast query
+   paths until a message actually has to be output.  */
+
+static void
+init_i18n (void)
+{
+  setlocale (LC_ALL, "");
+  bindtextdomain (PACKAGE, LOCALEDIR);
+  textdomain (PACKAGE);
+}
+
+/* Handle "stty size", "stty speed" and "stty -g" on standard input,
+   which shell prompts may run for every command, with only the system
+   call each query needs and without locale initialization, option
+   parsing, or setting up stdio.  Return false, having output nothing,
+   if the general path must be taken instead, for example to diagnose
+   an error in the user's language.  */
+
+static bool
+fast_query (int argc, char **argv)
+{
+  char buf[MAX (RECOVERABLE_BUFSIZE, 2 * INT_BUFSIZE_BOUND (uintmax_t))];
+  int len;
+
+  if (argc != 2)
+    return false;
+
+  char const *arg = argv[1];
+  if (STREQ (arg, "size"))
+    {
+#ifdef TIOCGWINSZ
+      struct winsize win;
+      if (get_win_size (STDIN_FILENO, &win))
+        return false;
+      len = sprintf (buf, "%d %d\n", win.ws_row, win.ws_col);
+#else
+      return false;
+#endif
+    }
+  else if (STREQ (arg, "speed") || STREQ (arg, "-g") || STREQ (arg, "--save"))
+    {
+      struct termios mode;
+      if (timed_tcgetattr (STDIN_FILENO, &mode))
+        return false;
+      if (arg[0] == '-')
+        len = format_recoverable (buf, &mode);
+      else
+        {
+          speed_t ispeed = cfgetispeed (&mode);
+          speed_t ospeed = cfgetospeed (&mode);
+          if (ispeed == 0 || ispeed == ospeed)
+            len = sprintf (buf, "%lu\n", baud_to_value (ospeed));
+          else
+            len = sprintf (buf, "%lu %lu\n", baud_to_value (ispeed),
+                           baud_to_value (ospeed));
+        }
+    }
+  else
+    return false;
+
+  if (full_write (STDOUT_FILENO, buf, len) != len)
+    {
+      int write_errno = errno;
+      init_i18n ();
+      error (EXIT_FAILURE, write_errno, _("write error"));
+    }
+  return true;
+}
+
+int
+main (int argc, char **argv)
+{
+  static struct termios mode;
+  enum output_type output_type;
+  int optc;
+  int argi = 0;
+  int opti = 1;
+  bool require_set_attr;
+  bool verbose_output;
+  bool recoverable_output;
+  bool noargs = true;
+  char *file_name = nullptr;
+  char const *device_name;
+
+  initialize_main (&argc, &argv);
+  set_program_name (argv[0]);
+
+  if (fast_query (argc, argv))
+    return EXIT_SUCCESS;
+
+  init_i18n ();
+
+  atexit (close_stdout);
+
+  output_type = changed;
+  verbose_output = false;
+  recoverable_output = false;
+
+  opterr = 0;
+
+  while ((optc = getopt_long (argc - argi, argv + argi, "-agF:",
+                              longopts, nullptr))
+         != -1)
+    {
+      process_option(optc, &verbose_output, &recoverable_output, 
+                     &output_type, &file_name, &noargs, 
+                     argv, &argi, &opti);
+
+      /* Clear fully-parsed arguments, so they don't confuse the 2nd pass.  */
+      while (opti < optind)
+        argv[argi + opti++] = nullptr;
+    }
+
+  validate_options(verbose_output, recoverable_output, noargs, output_type);
+
+  device_name = file_name ? file_name : _("standard input");
+
+  if (stats_output)
+    {
+      stats_new_device (device_name);
+      atexit (print_stats);
+    }
+
+  /* Likewise for --broadcast-size.  */
+  if (broadcast_size)
+    {
+      if (file_name)
+        open_device_file (device_name);
+      return broadcast_window_size (device_name, argc, argv);
+    }
+
+  /* The operands of --watch-queue are devices, not settings.  */
+  if (0 <= watch_queue_interval)
+    {
+      if (file_name)
+        open_device_file (device_name);
+      watch_queues (file_name || noargs, device_name, argc, argv);
+      return EXIT_SUCCESS;
+    }
+
+  if (!noargs && !verbose_output && !recoverable_output)
+    {
+      static struct termios check_mode;
+      apply_settings (true, device_name, argv, argc,
+                      &check_mode, &require_set_attr);
+    }
+
+  if (rfc2217_targets)
+    {
+      if (file_name)
+        error (EXIT_FAILURE, 0, _("--rfc2217 and --file are mutually exclusive"));
+      run_rfc2217 (rfc2217_targets, output_type,
+                   verbose_output || recoverable_output || noargs, argv, argc);
+      return EXIT_SUCCESS;
+    }
+
+  if (openpty_count)
+    {
+      if (file_name)
+        error (EXIT_FAILURE, 0, _("--openpty and --file are mutually exclusive"));
+      return open_ptys (openpty_count, argv, argc);
+    }
+
+  if (file_name)
+    open_device_file(device_name);
+
+  if (lock_device)
+    lock_device_file (file_name, device_name);
+
+  if (timed_tcgetattr (STDIN_FILENO, &mode))
+    error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+
+  if (size_wait != no_size_wait)
+    {
+      wait_window_size (size_wait, device_name);
+      return EXIT_SUCCESS;
+    }
+
+  if (wait_modem_lines)
+    {
+      wait_modem (device_name);
+      return EXIT_SUCCESS;
+    }
+
+  if (probe_size)
+    {
+      probe_window_size (&mode, file_name, device_name);
+      return EXIT_SUCCESS;
+    }
+
+  if (history_output)
+    {
+      display_history (device_name);
+      return EXIT_SUCCESS;
+    }
+
+  if (undo_index)
+    {
+      undo_settings (undo_index, device_name);
+      return EXIT_SUCCESS;
+    }
+
+  if (bench_output)
+    {
+      bench_throughput (&mode, device_name);
+      return EXIT_SUCCESS;
+    }
+
+  if (0 <= watch_icount_interval)
+    {
+      watch_icount (output_type == json, device_name);
+      return EXIT_SUCCESS;
+    }
+
+  if (verbose_output || recoverable_output || noargs)
+    {
+      max_col = screen_columns ();
+      current_col = 0;
+      display_settings (output_type, &mode, device_name);
+      return EXIT_SUCCESS;
+    }
+
+  struct history_record prev;
+  history_capture (&prev, &mode);
+
+  require_set_attr = false;
+  apply_settings (false, device_name, argv, argc,
+                  &mode, &require_set_attr);
+
+  perform_tty_actions (true, device_name);
+
+  if (require_set_attr)
+    {
+      struct mode_diff diff;
+      if (! apply_and_verify_settings (&mode, device_name, &diff))
+        error (EXIT_FAILURE, 0,
+               _("%s: unable to perform all requested operations"),
+               quotef (device_name));
+    }
+
+  history_save (&prev, &mode, device_name);
+
+  perform_tty_actions (false, device_name);
+
+  return EXIT_SUCCESS;
+}
+
+static bool
+process_option(int optc, bool *verbose_output, bool *recoverable_output,
+              enum output_type *output_type, char **file_name, 
+              bool *noargs, char **argv, int *argi, int *opti)
+{
+  switch (optc)
+    {
+    case 'a':
+      *verbose_output = true;
+      *output_type = all;
+      return true;
+
+    case 'g':
+      *recoverable_output = true;
+      *output_type = recoverable;
+      return true;
+
+    case JSON_OPTION:
+      *verbose_output = true;
+      *output_type = json;
+      return true;
+
+    case FINGERPRINT_OPTION:
+      fingerprint_output = true;
+      *output_type = fingerprint;
+      return true;
+
+    case FIELDS_OPTION:
+      fingerprint_fields = parse_fingerprint_fields (optarg);
+      return true;
+
+    case BENCH_OPTION:
+      bench_output = true;
+      return true;
+
+    case 'F':
+      if (*file_name)
+        error (EXIT_FAILURE, 0, _("only one device may be specified"));
+      *file_name = optarg;
+      return true;
+
+    case DEV_DEBUG_OPTION:
+      dev_debug = true;
+      return true;
+
+    case FAKE_TTY_OPTION:
+      use_fake_tty (optarg);
+      return true;
+
+    case DRAIN_POLICY_OPTION:
+      drain_policy = XARGMATCH ("--drain-policy", optarg,
+                                drain_policy_args, drain_policy_types);
+      return true;
+
+    case DRAIN_TIMEOUT_OPTION:
+      drain_timeout = integer_arg (optarg, INT_MAX);
+      return true;
+
+    case HISTORY_OPTION:
+      history_output = true;
+      return true;
+
+    case UNDO_OPTION:
+      undo_index = optarg ? integer_arg (optarg, HISTORY_SLOTS) : 1;
+      if (undo_index == 0)
+        error (EXIT_FAILURE, 0, _("invalid --undo argument %s"),
+               quote (optarg));
+      return true;
+
+    case LOCK_OPTION:
+      lock_device = true;
+      if (optarg)
+        lock_timeout = integer_arg (optarg, INT_MAX);
+      return true;
+
+    case BROADCAST_SIZE_OPTION:
+      broadcast_size = true;
+      broadcast_size_arg = optarg;
+      return true;
+
+    case RFC2217_OPTION:
+      rfc2217_targets = optarg;
+      return true;
+
+    case PROBE_SIZE_OPTION:
+      probe_size = true;
+      return true;
+
+    case STAGGER_OPTION:
+      stagger_ms = integer_arg (optarg, INT_MAX);
+      return true;
+
+    case OPENPTY_OPTION:
+      openpty_count = integer_arg (optarg, INT_MAX);
+      if (openpty_count == 0)
+        error (EXIT_FAILURE, 0, _("invalid --openpty argument %s"),
+               quote (optarg));
+      return true;
+
+    case RUN_OPTION:
+      openpty_command = optarg;
+      return true;
+
+    case MODEM_ORDER_OPTION:
+      modem_before = XARGMATCH ("--modem-order", optarg,
+                                modem_order_args, modem_order_types);
+      return true;
+
+    case STATS_OPTION:
+      {
+        static char const *const stats_formats[] = { "text", "json", nullptr };
+        stats_output = optarg ? XARGMATCH ("--stats", optarg,
+                                           stats_formats, stats_formats)
+                              : "text";
+      }
+      return true;
+
+    case TIMEOUT_OPTION:
+      wait_timeout = integer_arg (optarg, INT_MAX);
+      return true;
+
+    case WATCH_ICOUNT_OPTION:
+      watch_icount_interval = integer_arg (optarg, INT_MAX);
+      if (watch_icount_interval == 0)
+        error (EXIT_FAILURE, 0, _("invalid --watch-icount argument %s"),
+               quote (optarg));
+      return true;
+
+    case WATCH_QUEUE_OPTION:
+      watch_queue_interval = integer_arg (optarg, INT_MAX);
+      if (watch_queue_interval == 0)
+        error (EXIT_FAILURE, 0, _("invalid --watch-queue argument %s"),
+               quote (optarg));
+      return true;
+
+    case WAIT_MODEM_OPTION:
+      wait_modem_lines = parse_modem_lines (optarg);
+      return true;
+
+    case WAIT_SIZE_OPTION:
+      size_wait = size_wait_once;
+      return true;
+
+    case WATCH_SIZE_OPTION:
+      size_wait = size_wait_watch;
+      return true;
+
+    case_GETOPT_HELP_CHAR;
+
+    case_GETOPT_VERSION_CHAR (PROGRAM_NAME, AUTHORS);
+
+    default:
+      /* The N of --undo is optional, so it must be attached with '='.  */
+      if (undo_index)
+        {
+          char const *arg = argv[*argi + *opti];
+          if (c_isdigit (arg[0]) && !arg[strspn (arg, "0123456789")])
+            error (EXIT_FAILURE, 0,
+                   _("extra operand %s; --undo takes N only as --undo=N"),
+                   quote (arg));
+        }
+      if (! STREQ (argv[*argi + *opti], "-drain")
+          && ! STREQ (argv[*argi + *opti], "drain")
+          && ! STREQ (argv[*argi + *opti], "drainflush"))
+        *noargs = false;
+
+      *argi += *opti;
+      *opti = 1;
+      optind = 0;
+      return false;
+    }
+}
+
+static void
+validate_options(bool verbose_output, bool recoverable_output, bool noargs,
+                 enum output_type output_type)
+{
+  if (verbose_output && recoverable_output)
+    error (EXIT_FAILURE, 0,
+           _("the options for verbose and stty-readable output styles are\n"
+             "mutually exclusive"));
+
+  if (fingerprint_output)
+    {
+      if (verbose_output || recoverable_output)
+        error (EXIT_FAILURE, 0,
+               _("--fingerprint and the other output styles are"
+                 " mutually exclusive"));
+      /* Otherwise it is an output style like -g.  */
+      recoverable_output = true;
+    }
+
+  if (!noargs && (verbose_output || recoverable_output))
+    error (EXIT_FAILURE, 0,
+           _("when specifying an output style, modes may not be set"));
+
+  if (0 <= watch_queue_interval
+      && (verbose_output || recoverable_output || size_wait != no_size_wait
+          || bench_output))
+    error (EXIT_FAILURE, 0,
+           _("when watching queues, no other output style may be specified"));
+
+  if (0 <= watch_icount_interval
+      && (!noargs || recoverable_output || output_type == all
+          || size_wait != no_size_wait || bench_output
+          || 0 <= watch_queue_interval))
+    error (EXIT_FAILURE, 0,
+           _("--watch-icount may only be combined with --json"
+             " and --timeout"));
+
+  if (size_wait != no_size_wait
+      && (!noargs || verbose_output || recoverable_output))
+    error (EXIT_FAILURE, 0,
+           _("when waiting for size changes, no other output style"
+             " or modes may be specified"));
+
+  if (bench_output && (!noargs || verbose_output || recoverable_output
+                       || size_wait != no_size_wait))
+    error (EXIT_FAILURE, 0,
+           _("when benchmarking, no other output style"
+             " or modes may be specified"));
+
+  if (wait_modem_lines
+      && (!noargs || verbose_output || recoverable_output
+          || size_wait != no_size_wait || bench_output
+          || 0 <= watch_queue_interval || 0 <= watch_icount_interval))
+    error (EXIT_FAILURE, 0,
+           _("when waiting for modem line changes, no other output style"
+             " or modes may be specified"));
+
+  if (broadcast_size
+      && (verbose_output || recoverable_output || output_type == json
+          || openpty_count || undo_index || history_output || lock_device
+          || size_wait != no_size_wait || bench_output || wait_modem_lines
+          || 0 <= watch_queue_interval || 0 <= watch_icount_interval))
+    error (EXIT_FAILURE, 0,
+           _("--broadcast-size may only be combined with --stagger"));
+
+  if (fingerprint_fields && output_type != fingerprint)
+    error (EXIT_FAILURE, 0, _("--fields requires --fingerprint"));
+
+  if (stagger_ms && !broadcast_size)
+    error (EXIT_FAILURE, 0, _("--stagger requires --broadcast-size"));
+
+  if (rfc2217_targets
+      && (openpty_count || broadcast_size || undo_index || history_output
+          || lock_device || probe_size || size_wait != no_size_wait
+          || bench_output || wait_modem_lines
+          || 0 <= watch_queue_interval || 0 <= watch_icount_interval))
+    error (EXIT_FAILURE, 0,
+           _("--rfc2217 may only be combined with output styles and"
+             " settings"));
+
+  if (openpty_command && !openpty_count)
+    error (EXIT_FAILURE, 0, _("--run requires --openpty"));
+
+  if (openpty_count
+      && (verbose_output || recoverable_output || output_type == json
+          || undo_index || history_output || lock_device
+          || size_wait != no_size_wait || bench_output || wait_modem_lines
+          || 0 <= watch_queue_interval || 0 <= watch_icount_interval))
+    error (EXIT_FAILURE, 0,
+           _("--openpty may only be combined with --run and settings"));
+
+  if ((undo_index || history_output)
+      && (!noargs || verbose_output || recoverable_output
+          || (undo_index && history_output)
+          || size_wait != no_size_wait || bench_output || wait_modem_lines
+          || 0 <= watch_queue_interval || 0 <= watch_icount_interval))
+    error (EXIT_FAILURE, 0,
+           _("--undo and --history may not be combined with each other,"
+             " with an output style, or with modes"));
+
+  if (0 <= drain_timeout && size_wait != no_size_wait)
+    error (EXIT_FAILURE, 0,
+           _("--drain-timeout is not valid when waiting for size changes"));
+
+  if (probe_size
+      && (!noargs || verbose_output || recoverable_output
+          || output_type == json || undo_index || history_output
+          || size_wait != no_size_wait || bench_output || wait_modem_lines
+          || 0 <= watch_queue_interval || 0 <= watch_icount_interval))
+    error (EXIT_FAILURE, 0,
+           _("when probing the size, no other output style"
+             " or modes may be specified"));
+
+  if (0 <= wait_timeout && size_wait == no_size_wait && !wait_modem_lines
+      && !probe_size && !rfc2217_targets
+      && watch_queue_interval < 0 && watch_icount_interval < 0)
+    error (EXIT_FAILURE, 0,
+           _("--timeout is only valid with --wait-size, --watch-size,"
+             " --probe-size, --wait-modem, --watch-queue, --watch-icount"
+             " or --rfc2217"));
+}
+
+static void
+open_device_file(char const *device_name)
+{
+  int fdflags;
+  struct timespec start;
+  stats_start (&start);
+  int fd = fd_reopen (STDIN_FILENO, device_name, O_RDONLY | O_NONBLOCK, 0);
+  stats_stop (stat_open, &start);
+  if (fd < 0)
+    error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+  if ((fdflags = timed_fcntl (STDIN_FILENO, F_GETFL, 0)) == -1
+      || timed_fcntl (STDIN_FILENO, F_SETFL, fdflags & ~O_NONBLOCK) < 0)
+    error (EXIT_FAILURE, errno, _("%s: couldn't reset non-blocking mode"),
+           quotef (device_name));
+}
+
+/* Open the --undo history of standard input, creating it if CREATE.
+   It lives in $XDG_RUNTIME_DIR/stty, or else in /tmp/stty-UID, and is
+   named after the device number, so all names of a tty share it.
+   Return -1 with errno set on failure.  */
+
+static int
+history_open (bool create)
+{
+  /* The state of another backend is not that of the device on
+     standard input, so keep it out of the device's history.  */
+  if (backend != &kernel_backend)
+    {
+      errno = ENOTTY;
+      return -1;
+    }
+
+  struct stat st;
+  if (fstat (STDIN_FILENO, &st) != 0)
+    return -1;
+  if (! S_ISCHR (st.st_mode))
+    {
+      errno = ENOTTY;
+      return -1;
+    }
+
+  char const *runtime_dir = getenv ("XDG_RUNTIME_DIR");
+  char *dir = (runtime_dir && *runtime_dir
+               ? xasprintf ("%s/stty", runtime_dir)
+               : xasprintf ("/tmp/stty-%ju", (uintmax_t) getuid ()));
+  if (create && mkdir (dir, S_IRWXU) != 0 && errno != EEXIST)
+    {
+      int saved_errno = errno;
+      free (dir);
+      errno = saved_errno;
+      return -1;
+    }
+
+  /* Refuse a directory someone else made, in a shared /tmp.  */
+  struct stat dst;
+  bool ok = lstat (dir, &dst) == 0;
+  if (! ok || ! S_ISDIR (dst.st_mode) || dst.st_uid != getuid ())
+    {
+      int saved_errno = ok ? EACCES : errno;
+      free (dir);
+      errno = saved_errno;
+      return -1;
+    }
+
+  char *name = xasprintf ("%s/%jx", dir, (uintmax_t) st.st_rdev);
+  int fd = open (name, (create ? O_RDWR | O_CREAT : O_RDONLY)
+                       | O_CLOEXEC | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+  int saved_errno = errno;
+  free (name);
+  free (dir);
+  errno = saved_errno;
+  return fd;
+}
+
+/* Read the used records of the history open on FD into RING, most
+   recent first, and return how many there are.  */
+
+static int
+history_read (int fd, struct history_record ring[HISTORY_SLOTS])
+{
+  ssize_t size = pread (fd, ring, HISTORY_SLOTS * sizeof *ring, 0);
+  int n = 0;
+
+  for (int i = 0; i < HISTORY_SLOTS; i++)
+    if ((i + 1) * (ssize_t) sizeof *ring <= size
+        && ring[i].magic == HISTORY_MAGIC)
+      ring[n++] = ring[i];
+
+  /* Insertion sort by decreasing sequence number; N is tiny.  */
+  for (int i = 1; i < n; i++)
+    {
+      struct history_record r = ring[i];
+      int j = i;
+      for (; 0 < j && ring[j - 1].seq < r.seq; j--)
+        ring[j] = ring[j - 1];
+      ring[j] = r;
+    }
+  return n;
+}
+
+/* Store the device state MODE, and its window size, into *REC.  */
+
+static void
+history_capture (struct history_record *rec, struct termios const *mode)
+{
+  memset (rec, 0, sizeof *rec);
+  rec->magic = HISTORY_MAGIC;
+  rec->mode = *mode;
+  rec->rows = rec->cols = -1;
+#ifdef TIOCGWINSZ
+  struct winsize win;
+  if (get_win_size (STDIN_FILENO, &win) == 0)
+    {
+      rec->rows = win.ws_row;
+      rec->cols = win.ws_col;
+    }
+#endif
+}
+
+/* Save *REC, the state from before the settings were applied, as the
+   most recent --undo record, if it differs from MODE, the settings now
+   in effect, or the window size has changed since.  So repeating a
+   change does not push older states out of the ring.  Failing to save
+   is not an error: the history is only a convenience.  */
+
+static void
+history_save (struct history_record *rec, struct termios *mode,
+              char const *device_name)
+{
+  if (eq_mode (&rec->mode, mode))
+    {
+      struct history_record now;
+      history_capture (&now, mode);
+      if (now.rows == rec->rows && now.cols == rec->cols)
+        return;
+    }
+
+  int fd = history_open (true);
+  if (fd < 0)
+    {
+      if (dev_debug)
+        error (0, errno, _("%s: cannot save settings for --undo"),
+               quotef (device_name));
+      return;
+    }
+
+  /* Lock out concurrent runs between reading the last sequence number
+     and writing the next one, so they do not both take it.  The lock
+     is held for only one read and one write.  */
+  struct history_record ring[HISTORY_SLOTS];
+  bool ok = flock (fd, LOCK_EX) == 0;
+  if (ok)
+    {
+      int n = history_read (fd, ring);
+      rec->seq = n ? ring[0].seq + 1 : 1;
+      rec->when = time (nullptr);
+      ok = (pwrite (fd, rec, sizeof *rec,
+                    rec->seq % HISTORY_SLOTS * sizeof *rec) == sizeof *rec);
+    }
+  if (!ok && dev_debug)
+    error (0, errno, _("%s: cannot save settings for --undo"),
+           quotef (device_name));
+  close (fd);
+}
+
+/* Read the history of standard input into RING, most recent first,
+   and return the number of records.  Fail if there are none.  */
+
+static int
+history_load (struct history_record ring[HISTORY_SLOTS],
+              char const *device_name)
+{
+  int fd = history_open (false);
+  if (fd < 0)
+    {
+      if (errno == ENOENT)
+        error (EXIT_FAILURE, 0, _("%s: no saved settings"),
+               quotef (device_name));
+      error (EXIT_FAILURE, errno, _("%s: cannot read saved settings"),
+             quotef (device_name));
+    }
+  /* Do not read a record while it is being written.  */
+  flock (fd, LOCK_SH);
+  int n = history_read (fd, ring);
+  close (fd);
+  if (n == 0)
+    error (EXIT_FAILURE, 0, _("%s: no saved settings"),
+           quotef (device_name));
+  return n;
+}
+
+/* List the saved states of standard input, most recent first, each
+   with the N that --undo takes to restore it.  */
+
+static void
+display_history (char const *device_name)
+{
+  struct history_record ring[HISTORY_SLOTS];
+  int n = history_load (ring, device_name);
+
+  for (int i = 0; i < n; i++)
+    {
+      char when[sizeof "YYYY-MM-DD HH:MM:SS" + INT_BUFSIZE_BOUND (int)];
+      char modes[RECOVERABLE_BUFSIZE];
+      time_t t = ring[i].when;
+      struct tm *tm = localtime (&t);
+      if (! (tm && strftime (when, sizeof when, "%Y-%m-%d %H:%M:%S", tm)))
+        strcpy (when, "?");
+      format_modes (modes, &ring[i].mode);
+      printf ("%d  %s  %lu", i + 1, when,
+              baud_to_value (cfgetospeed (&ring[i].mode)));
+      if (0 <= ring[i].rows)
+        printf ("  %dx%d", ring[i].rows, ring[i].cols);
+      printf ("  %s\n", modes);
+    }
+}
+
+/* Restore the Nth most recent saved state of standard input.  This does
+   not itself save a record, so successive --undo=1, --undo=2 and so on
+   step further back.  */
+
+static void
+undo_settings (int n, char const *device_name)
+{
+  struct history_record ring[HISTORY_SLOTS];
+  int count = history_load (ring, device_name);
+  if (count < n)
+    error (EXIT_FAILURE, 0,
+           ngettext ("%s: only %d saved setting", "%s: only %d saved settings",
+                     count),
+           quotef (device_name), count);
+
+  struct mode_diff diff;
+  if (! apply_and_verify_settings (&ring[n - 1].mode, device_name, &diff))
+    error (EXIT_FAILURE, 0,
+           _("%s: unable to perform all requested operations"),
+           quotef (device_name));
+#ifdef TIOCGWINSZ
+  if (0 <= ring[n - 1].rows)
+    set_window_size (ring[n - 1].rows, ring[n - 1].cols, device_name);
+#endif
+}
+
+/* Forget the driver settings read from the previous device, for the
+   modes that configure several devices in one run.  */
+
+static void
+forget_driver_settings (void)
+{
+#if USE_TIOCSSERIAL
+  serial_info_read = serial_info_changed = false;
+#endif
+#if USE_TIOCSRS485
+  rs485_info_read = false;
+#endif
+}
+
+/* Apply the settings in ARGV to standard input, the device NAME, for
+   the modes that configure several devices in one run.  */
+
+static void
+configure_stdin (char const *name, char **argv, int argc)
+{
+  stats_new_device (name);
+  forget_driver_settings ();
+
+  struct termios mode;
+  if (timed_tcgetattr (STDIN_FILENO, &mode))
+    error (EXIT_FAILURE, errno, "%s", quotef (name));
+  bool require_set_attr = false;
+  apply_settings (false, name, argv, argc, &mode, &require_set_attr);
+  perform_tty_actions (true, name);
+  struct mode_diff diff;
+  if (require_set_attr && ! apply_and_verify_settings (&mode, name, &diff))
+    error (EXIT_FAILURE, 0,
+           _("%s: unable to perform all requested operations"),
+           quotef (name));
+  perform_tty_actions (false, name);
+}
+
+/* Create N ptys, apply the settings in ARGV to each, and then either
+   run openpty_command with their masters open and return its exit
+   status, or print the pty names and sleep until killed, since closing
+   the masters would remove the ptys.  The settings are applied
+   in-process through standard input, which is restored afterward.  */
+
+static int
+open_ptys (int n, char **argv, int argc)
+{
+  int *masters = xnmalloc (n, sizeof *masters);
+  char **names = xnmalloc (n, sizeof *names);
+  int saved_stdin = dup (STDIN_FILENO);
+
+  for (int i = 0; i < n; i++)
+    {
+      char const *slave_name;
+      int slave;
+
+      masters[i] = posix_openpt (O_RDWR | O_NOCTTY);
+      if (masters[i] < 0 || grantpt (masters[i]) != 0
+          || unlockpt (masters[i]) != 0
+          || ! (slave_name = ptsname (masters[i]))
+          || (slave = open (slave_name, O_RDWR | O_NOCTTY)) < 0
+          || (slave != STDIN_FILENO && dup2 (slave, STDIN_FILENO) < 0))
+        error (EXIT_FAILURE, errno, _("cannot create a pty"));
+      names[i] = xstrdup (slave_name);
+      if (slave != STDIN_FILENO)
+        close (slave);
+
+      configure_stdin (names[i], argv, argc);
+    }
+
+  if (saved_stdin < 0)
+    close (STDIN_FILENO);
+  else if (dup2 (saved_stdin, STDIN_FILENO) < 0 || close (saved_stdin) != 0)
+    error (EXIT_FAILURE, errno, _("cannot restore standard input"));
+
+  if (! openpty_command)
+    {
+      for (int i = 0; i < n; i++)
+        puts (names[i]);
+      /* Let a reader of the names see end of file.  */
+      if (fclose (stdout) != 0)
+        error (EXIT_FAILURE, errno, _("write error"));
+      while (true)
+        pause ();
+    }
+
+  size_t fds_size = n * INT_BUFSIZE_BOUND (int), names_size = 0;
+  for (int i = 0; i < n; i++)
+    names_size += strlen (names[i]) + 1;
+  char *fds = xmalloc (fds_size), *fd_end = fds;
+  char *name_list = xmalloc (names_size), *name_end = name_list;
+  for (int i = 0; i < n; i++)
+    {
+      fd_end += sprintf (fd_end, i ? " %d" : "%d", masters[i]);
+      if (i)
+        *name_end++ = ' ';
+      name_end = stpcpy (name_end, names[i]);
+    }
+  if (setenv ("STTY_PTY_MASTERS", fds, 1) != 0
+      || setenv ("STTY_PTY_NAMES", name_list, 1) != 0)
+    xalloc_die ();
+
+  if (fflush (stdout) != 0)
+    error (EXIT_FAILURE, errno, _("write error"));
+  pid_t pid = fork ();
+  if (pid < 0)
+    error (EXIT_FAILURE, errno, _("cannot fork"));
+  if (pid == 0)
+    {
+      execl ("/bin/sh", "sh", "-c", openpty_command, (char *) nullptr);
+      int exit_status = errno == ENOENT ? EXIT_ENOENT : EXIT_CANNOT_INVOKE;
+      error (0, errno, _("failed to run command %s"), quote (openpty_command));
+      _exit (exit_status);
+    }
+
+  int status;
+  while (waitpid (pid, &status, 0) < 0)
+    if (errno != EINTR)
+      error (EXIT_FAILURE, errno, _("error waiting for command"));
+  return (WIFEXITED (status) ? WEXITSTATUS (status)
+          : 128 + WTERMSIG (status));
+}
+
+/* RFC 2217, the Telnet COM-PORT-OPTION, with which terminal servers
+   let a client configure their serial ports over TCP, one port per
+   connection.  The connection takes the place of standard input, and
+   the backend below maps termios and modem line changes onto option
+   subnegotiations.  Each call sends all its requests in one write and
+   then reads the replies, which come in order; so reading or changing
+   all settings is a single round trip.  With several ports, all are
+   connected at once, and each round trip is made on all of them before
+   their replies are collected, so the delays overlap.  */
+enum
+  {
+    TELNET_SE = 240, TELNET_SB = 250, TELNET_WILL = 251, TELNET_WONT = 252,
+    TELNET_DO = 253, TELNET_DONT = 254, TELNET_IAC = 255,
+    COM_PORT_OPTION = 44
+  };
+
+/* Client commands; the server answers each with the command plus
+   CPO_SERVER.  A value of 0 asks for the current setting.  */
+enum
+  {
+    CPO_SET_BAUDRATE = 1, CPO_SET_DATASIZE = 2, CPO_SET_PARITY = 3,
+    CPO_SET_STOPSIZE = 4, CPO_SET_CONTROL = 5,
+    CPO_SERVER = 100
+  };
+
+/* Values of CPO_SET_PARITY, CPO_SET_STOPSIZE and CPO_SET_CONTROL.  */
+enum
+  {
+    CPO_PARITY_NONE = 1, CPO_PARITY_ODD = 2, CPO_PARITY_EVEN = 3,
+    CPO_PARITY_MARK = 4, CPO_PARITY_SPACE = 5,
+    CPO_STOP_1 = 1, CPO_STOP_2 = 2,
+    CPO_FLOW_NONE = 1, CPO_FLOW_XONXOFF = 2, CPO_FLOW_HARDWARE = 3,
+    CPO_DTR_REQUEST = 7, CPO_DTR_ON = 8, CPO_DTR_OFF = 9,
+    CPO_RTS_REQUEST = 10, CPO_RTS_ON = 11, CPO_RTS_OFF = 12
+  };
+
+/* Requests of one round trip, and their replies.  */
+enum { CPO_MAX_REQUESTS = 8 };
+struct cpo_batch
+{
+  int n;
+  unsigned char cmd[CPO_MAX_REQUESTS];
+  unsigned char size[CPO_MAX_REQUESTS];
+  uint32_t value[CPO_MAX_REQUESTS];
+};
+
+/* How long to wait for a connection or a reply, unless --timeout.  */
+enum { CPO_TIMEOUT_MS = 5000 };
+
+/* Telnet stream parser state of a connection: VERB is the pending DO,
+   DONT, WILL or WONT, or the SB being collected into SUB, and GOT the
+   number of replies read.  Serial data is ignored, as are notifications
+   and replies to other options.  */
+enum cpo_state { CPO_DATA, CPO_IAC, CPO_VERB, CPO_SUB, CPO_SUB_IAC };
+struct cpo_reader
+{
+  enum cpo_state state;
+  int verb;
+  unsigned char sub[8];
+  size_t sublen;
+  int got;
+};
+
+/* A terminal server port of --rfc2217, and its connection.  */
+struct rfc2217_port
+{
+  char const *address;
+  struct addrinfo *addrs;	/* What ADDRESS resolved to.  */
+  struct addrinfo *addr;	/* The one being connected to.  */
+  int fd;
+  int err;			/* Why the last address failed.  */
+  bool connected;
+  struct device_stats *stats;
+  struct cpo_batch batch;	/* Requests of the current round trip.  */
+  struct cpo_reader reader;
+  struct termios mode;		/* Its settings, as read or confirmed.  */
+  struct termios request;	/* The settings to apply.  */
+};
+
+/* The settings last read from or confirmed by the server, if valid.  */
+static struct termios cpo_mode;
+static bool cpo_mode_valid;
+
+static int
+cpo_timeout (void)
+{
+  return 0 <= wait_timeout ? wait_timeout : CPO_TIMEOUT_MS;
+}
+
+static void
+cpo_add (struct cpo_batch *b, int cmd, uint32_t value)
+{
+  affirm (b->n < CPO_MAX_REQUESTS);
+  b->cmd[b->n] = cmd;
+  b->size[b->n] = cmd == CPO_SET_BAUDRATE ? 4 : 1;
+  b->value[b->n] = value;
+  b->n++;
+}
+
+/* Send the requests in B over FD, and prepare *R to read the replies.
+   Return -1 with errno set on failure.  */
+
+static int
+cpo_send (int fd, struct cpo_batch const *b, struct cpo_reader *r)
+{
+  unsigned char out[CPO_MAX_REQUESTS * 16];
+  size_t len = 0;
+
+  for (int i = 0; i < b->n; i++)
+    {
+      out[len++] = TELNET_IAC;
+      out[len++] = TELNET_SB;
+      out[len++] = COM_PORT_OPTION;
+      out[len++] = b->cmd[i];
+      for (int j = b->size[i] - 1; 0 <= j; j--)
+        {
+          unsigned char byte = b->value[i] >> (8 * j);
+          out[len++] = byte;
+          if (byte == TELNET_IAC)
+            out[len++] = byte;
+        }
+      out[len++] = TELNET_IAC;
+      out[len++] = TELNET_SE;
+    }
+  *r = (struct cpo_reader) { .state = CPO_DATA };
+  return full_write (fd, out, len) == len ? 0 : -1;
+}
+
+/* Read from FD what has arrived of the replies to the requests in B,
+   and store their values into B.  Return 1 once all have arrived, 0 if
+   more are to come, or -1 with errno set on failure.  */
+
+static int
+cpo_receive (int fd, struct cpo_reader *r, struct cpo_batch *b)
+{
+  unsigned char in[512];
+  ssize_t n = read (fd, in, sizeof in);
+  if (n <= 0)
+    {
+      if (n < 0 && errno == EINTR)
+        return 0;
+      if (n == 0)
+        errno = ECONNRESET;
+      return -1;
+    }
+
+  for (ssize_t i = 0; i < n; i++)
+    {
+      unsigned char c = in[i];
+      switch (r->state)
+        {
+        case CPO_DATA:
+          if (c == TELNET_IAC)
+            r->state = CPO_IAC;
+          break;
+
+        case CPO_IAC:
+          r->state = CPO_DATA;
+          if (c == TELNET_SB)
+            {
+              r->state = CPO_SUB;
+              r->sublen = 0;
+            }
+          else if (TELNET_WILL <= c && c <= TELNET_DONT)
+            {
+              r->state = CPO_VERB;
+              r->verb = c;
+            }
+          break;
+
+        case CPO_VERB:
+          r->state = CPO_DATA;
+          if (c == COM_PORT_OPTION)
+            {
+              if (r->verb == TELNET_DONT || r->verb == TELNET_WONT)
+                {
+                  errno = ENOTSUP;
+                  return -1;
+                }
+            }
+          else if (r->verb == TELNET_DO || r->verb == TELNET_WILL)
+            {
+              /* Refuse all other options.  */
+              unsigned char no[3] =
+                { TELNET_IAC, r->verb == TELNET_DO ? TELNET_WONT
+                                                   : TELNET_DONT, c };
+              if (full_write (fd, no, sizeof no) != sizeof no)
+                return -1;
+            }
+          break;
+
+        case CPO_SUB:
+          if (c == TELNET_IAC)
+            r->state = CPO_SUB_IAC;
+          else if (r->sublen < sizeof r->sub)
+            r->sub[r->sublen++] = c;
+          break;
+
+        case CPO_SUB_IAC:
+          if (c == TELNET_IAC)
+            {
+              r->state = CPO_SUB;
+              if (r->sublen < sizeof r->sub)
+                r->sub[r->sublen++] = c;
+              break;
+            }
+          r->state = CPO_DATA;
+          if (c == TELNET_SE && r->got < b->n && 2 <= r->sublen
+              && r->sub[0] == COM_PORT_OPTION
+              && r->sub[1] == b->cmd[r->got] + CPO_SERVER
+              && r->sublen == 2 + b->size[r->got])
+            {
+              uint32_t v = 0;
+              for (size_t j = 2; j < r->sublen; j++)
+                v = v << 8 | r->sub[j];
+              b->value[r->got++] = v;
+            }
+          break;
+        }
+    }
+  return r->got == b->n;
+}
+
+/* Send the requests in B over FD and replace their values with the
+   server's replies.  Return -1 with errno set on failure.  */
+
+static int
+cpo_exchange (int fd, struct cpo_batch *b)
+{
+  struct cpo_reader r;
+  if (cpo_send (fd, b, &r) != 0)
+    return -1;
+
+  struct timespec deadline;
+  deadline_from_ms (&deadline, cpo_timeout ());
+  int done = b->n == 0;
+
+  while (!done)
+    {
+      struct pollfd pfd = { .fd = fd, .events = POLLIN };
+      int left = ms_until (&deadline);
+      int n = left == 0 ? 0 : poll (&pfd, 1, left);
+      if (n == 0)
+        {
+          errno = ETIMEDOUT;
+          return -1;
+        }
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      done = cpo_receive (fd, &r, b);
+      if (done < 0)
+        return -1;
+    }
+  return 0;
+}
+
+/* Send each of the N PORTS the requests in its batch, then read their
+   replies as they come, so that the round trips overlap.  Count the
+   time each port took as a CALL of it.  Skip the ports with an empty
+   batch.  Exit on failure, naming the port.  */
+
+static void
+cpo_exchange_ports (struct rfc2217_port *ports, int n, enum stat_call call)
+{
+  struct pollfd *pfd = xnmalloc (n, sizeof *pfd);
+  int pending = 0;
+  struct timespec start;
+  stats_start (&start);
+
+  for (int i = 0; i < n; i++)
+    {
+      pfd[i].fd = -1;
+      pfd[i].events = POLLIN;
+      if (ports[i].batch.n == 0)
+        continue;
+      if (cpo_send (ports[i].fd, &ports[i].batch, &ports[i].reader) != 0)
+        error (EXIT_FAILURE, errno, "%s", quotef (ports[i].address));
+      pfd[i].fd = ports[i].fd;
+      pending++;
+    }
+
+  struct timespec deadline;
+  deadline_from_ms (&deadline, cpo_timeout ());
+
+  while (pending)
+    {
+      int left = ms_until (&deadline);
+      int r = left == 0 ? 0 : poll (pfd, n, left);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        {
+          int i = 0;
+          while (pfd[i].fd < 0)
+            i++;
+          error (EXIT_FAILURE, r < 0 ? errno : ETIMEDOUT, "%s",
+                 quotef (ports[i].address));
+        }
+
+      for (int i = 0; i < n; i++)
+        if (0 <= pfd[i].fd && pfd[i].revents)
+          {
+            struct rfc2217_port *p = &ports[i];
+            int done = cpo_receive (p->fd, &p->reader, &p->batch);
+            if (done < 0)
+              error (EXIT_FAILURE, errno, "%s", quotef (p->address));
+            if (done)
+              {
+                /* poll ignores a negative descriptor.  */
+                pfd[i].fd = -1;
+                pending--;
+                stats_device = p->stats;
+                stats_stop (call, &start);
+              }
+          }
+    }
+  free (pfd);
+}
+
+/* Store the serial settings reported in B into *MODE.  */
+
+static void
+cpo_store (struct termios *mode, struct cpo_batch const *b)
+{
+  for (int i = 0; i < b->n; i++)
+    {
+      uint32_t v = b->value[i];
+      switch (b->cmd[i])
+        {
+        case CPO_SET_BAUDRATE:
+          {
+            speed_t speed = value_to_baud (v);
+            if (speed != (speed_t) -1)
+              {
+                cfsetispeed (mode, speed);
+                cfsetospeed (mode, speed);
+              }
+          }
+          break;
+
+        case CPO_SET_DATASIZE:
+          if (5 <= v && v <= 8)
+            mode->c_cflag = ((mode->c_cflag & ~CSIZE)
+                             | (v == 5 ? CS5 : v == 6 ? CS6
+                                : v == 7 ? CS7 : CS8));
+          break;
+
+        case CPO_SET_PARITY:
+          mode->c_cflag &= ~(PARENB | PARODD);
+#ifdef CMSPAR
+          mode->c_cflag &= ~CMSPAR;
+          if (v == CPO_PARITY_MARK || v == CPO_PARITY_SPACE)
+            mode->c_cflag |= CMSPAR;
+#endif
+          if (v != CPO_PARITY_NONE)
+            mode->c_cflag |= PARENB;
+          if (v == CPO_PARITY_ODD || v == CPO_PARITY_MARK)
+            mode->c_cflag |= PARODD;
+          break;
+
+        case CPO_SET_STOPSIZE:
+          if (v == CPO_STOP_2)
+            mode->c_cflag |= CSTOPB;
+          else
+            mode->c_cflag &= ~CSTOPB;
+          break;
+
+        case CPO_SET_CONTROL:
+          /* Only the outbound flow control values belong in the mode,
+             not the modem line ones.  */
+          if (CPO_FLOW_HARDWARE < v)
+            break;
+#ifdef CRTSCTS
+          mode->c_cflag &= ~CRTSCTS;
+          if (v == CPO_FLOW_HARDWARE)
+            mode->c_cflag |= CRTSCTS;
+#endif
+          /* Software flow control goes both ways; keep whichever of
+             ixon and ixoff asked for it.  */
+          if (v != CPO_FLOW_XONXOFF)
+            mode->c_iflag &= ~(IXON | IXOFF);
+          else if (! (mode->c_iflag & (IXON | IXOFF)))
+            mode->c_iflag |= IXON | IXOFF;
+          break;
+        }
+    }
+}
+
+/* Add to B the requests that ask for all serial settings.  */
+
+static void
+rfc2217_query (struct cpo_batch *b)
+{
+  cpo_add (b, CPO_SET_BAUDRATE, 0);
+  cpo_add (b, CPO_SET_DATASIZE, 0);
+  cpo_add (b, CPO_SET_PARITY, 0);
+  cpo_add (b, CPO_SET_STOPSIZE, 0);
+  cpo_add (b, CPO_SET_CONTROL, 0);
+}
+
+static int
+rfc2217_get_attr (int fd, struct termios *mode)
+{
+  if (! cpo_mode_valid)
+    {
+      struct cpo_batch b = { 0 };
+      rfc2217_query (&b);
+      if (cpo_exchange (fd, &b) != 0)
+        return -1;
+      default_mode (&cpo_mode);
+      cpo_store (&cpo_mode, &b);
+      cpo_mode_valid = true;
+    }
+  *mode = cpo_mode;
+  return 0;
+}
+
+/* Add to B the requests that set the serial settings of MODE.  */
+
+static void
+rfc2217_request (struct cpo_batch *b, struct termios const *mode)
+{
+  tcflag_t size = mode->c_cflag & CSIZE;
+  int flow = CPO_FLOW_NONE;
+#ifdef CRTSCTS
+  if (mode->c_cflag & CRTSCTS)
+    flow = CPO_FLOW_HARDWARE;
+  else
+#endif
+  if (mode->c_iflag & (IXON | IXOFF))
+    flow = CPO_FLOW_XONXOFF;
+
+  /* Speed 0 means hang up, but a SET-BAUDRATE of 0 only asks for the
+     current rate.  So drop DTR instead, as the kernel does, and keep
+     the rate.  */
+  speed_t ospeed = cfgetospeed (mode);
+  if (ospeed == B0)
+    cpo_add (b, CPO_SET_CONTROL, CPO_DTR_OFF);
+  else
+    cpo_add (b, CPO_SET_BAUDRATE, baud_to_value (ospeed));
+  cpo_add (b, CPO_SET_DATASIZE,
+           size == CS5 ? 5 : size == CS6 ? 6 : size == CS7 ? 7 : 8);
+  cpo_add (b, CPO_SET_PARITY,
+           ! (mode->c_cflag & PARENB) ? CPO_PARITY_NONE
+#ifdef CMSPAR
+           : mode->c_cflag & CMSPAR
+           ? (mode->c_cflag & PARODD ? CPO_PARITY_MARK : CPO_PARITY_SPACE)
+#endif
+           : mode->c_cflag & PARODD ? CPO_PARITY_ODD : CPO_PARITY_EVEN);
+  cpo_add (b, CPO_SET_STOPSIZE,
+           mode->c_cflag & CSTOPB ? CPO_STOP_2 : CPO_STOP_1);
+  cpo_add (b, CPO_SET_CONTROL, flow);
+}
+
+/* Update *CURRENT, the settings of a port, with what it confirmed in B,
+   its replies to rfc2217_request for *MODE.  The settings that do not
+   map to RFC 2217 stay as they were, so that changing them fails
+   verification.  */
+
+static void
+rfc2217_confirm (struct termios *current, struct termios const *mode,
+                 struct cpo_batch const *b)
+{
+  tcflag_t iflag = current->c_iflag;
+  current->c_iflag = ((iflag & ~(IXON | IXOFF))
+                      | (mode->c_iflag & (IXON | IXOFF)));
+  cpo_store (current, b);
+  if (cfgetospeed (mode) == B0)
+    {
+      cfsetispeed (current, cfgetispeed (mode));
+      cfsetospeed (current, B0);
+    }
+}
+
+/* Send the serial settings of MODE, and remember what the server
+   confirmed, so that reading them back costs no round trip.  */
+
+static int
+rfc2217_set_attr (int fd, MAYBE_UNUSED int action, struct termios const *mode)
+{
+  struct cpo_batch b = { 0 };
+  rfc2217_request (&b, mode);
+  if (cpo_exchange (fd, &b) != 0)
+    return -1;
+
+  if (! cpo_mode_valid)
+    default_mode (&cpo_mode);
+  rfc2217_confirm (&cpo_mode, mode, &b);
+  cpo_mode_valid = true;
+  return 0;
+}
+
+/* Support the DTR and RTS modem control lines.  The port has no window
+   size, which callers expect to be reported as EINVAL.  */
+
+static int
+rfc2217_control (int fd, unsigned long int request, void *arg)
+{
+#ifdef TIOCGWINSZ
+  if (request == TIOCGWINSZ || request == TIOCSWINSZ)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+#endif
+#if USE_TIOCM
+  struct cpo_batch b = { 0 };
+  int bits = request == TIOCMGET ? 0 : *(int *) arg;
+
+  if (request == TIOCMGET)
+    {
+      cpo_add (&b, CPO_SET_CONTROL, CPO_DTR_REQUEST);
+      cpo_add (&b, CPO_SET_CONTROL, CPO_RTS_REQUEST);
+    }
+  else if ((request == TIOCMBIS || request == TIOCMBIC)
+           && ! (bits & ~(TIOCM_DTR | TIOCM_RTS)))
+    {
+      bool on = request == TIOCMBIS;
+      if (bits & TIOCM_DTR)
+        cpo_add (&b, CPO_SET_CONTROL, on ? CPO_DTR_ON : CPO_DTR_OFF);
+      if (bits & TIOCM_RTS)
+        cpo_add (&b, CPO_SET_CONTROL, on ? CPO_RTS_ON : CPO_RTS_OFF);
+    }
+  else
+    {
+      errno = ENOTTY;
+      return -1;
+    }
+
+  if (cpo_exchange (fd, &b) != 0)
+    return -1;
+  if (request == TIOCMGET)
+    *(int *) arg = ((b.value[0] == CPO_DTR_ON ? TIOCM_DTR : 0)
+                    | (b.value[1] == CPO_RTS_ON ? TIOCM_RTS : 0));
+  return 0;
+#else
+  errno = ENOTTY;
+  return -1;
+#endif
+}
+
+static struct tty_backend const rfc2217_backend =
+{
+  rfc2217_get_attr, rfc2217_set_attr, rfc2217_control
+};
+
+/* Resolve the address of the port P, HOST:PORT with HOST possibly in
+   brackets.  */
+
+static void
+rfc2217_resolve (struct rfc2217_port *p)
+{
+  char *host = xstrdup (p->address);
+  char *colon = strrchr (host, ':');
+  if (!colon || colon == host || !colon[1])
+    error (EXIT_FAILURE, 0, _("invalid terminal server address %s"),
+           quote (p->address));
+  *colon = '\0';
+  char const *port = colon + 1;
+  if (host[0] == '[' && colon[-1] == ']')
+    {
+      colon[-1] = '\0';
+      memmove (host, host + 1, colon - host);
+    }
+
+  struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+  int err = getaddrinfo (host, port, &hints, &p->addrs);
+  if (err)
+    error (EXIT_FAILURE, 0, "%s: %s", quotef (p->address),
+           gai_strerror (err));
+  free (host);
+  p->addr = p->addrs;
+  p->fd = -1;
 }
 
-int
-main (int argc, char **argv)
+/* Start connecting the port P to its next address, skipping those that
+   fail at once.  Exit if none is left.  */
+
+static void
+rfc2217_start_connect (struct rfc2217_port *p)
 {
-  static struct termios mode;
-  enum output_type output_type;
-  int optc;
-  int argi = 0;
-  int opti = 1;
-  bool require_set_attr;
-  bool verbose_output;
-  bool recoverable_output;
-  bool noargs = true;
-  char *file_name = nullptr;
-  char const *device_name;
+  for (; p->addr; p->addr = p->addr->ai_next)
+    {
+      struct addrinfo *ai = p->addr;
+      p->fd = socket (ai->ai_family,
+                      ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                      ai->ai_protocol);
+      if (p->fd < 0)
+        {
+          p->err = errno;
+          continue;
+        }
+      if (connect (p->fd, ai->ai_addr, ai->ai_addrlen) == 0
+          || errno == EINPROGRESS)
+        return;
+      p->err = errno;
+      close (p->fd);
+    }
+  error (EXIT_FAILURE, p->err, "%s", quotef (p->address));
+}
 
-  initialize_main (&argc, &argv);
-  set_program_name (argv[0]);
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+/* Connect to the N terminal server PORTS all at once, and offer
+   COM-PORT-OPTION on each connection.  Count the time each took as
+   its open for --stats.  */
 
-  atexit (close_stdout);
+static void
+rfc2217_connect_ports (struct rfc2217_port *ports, int n)
+{
+  struct pollfd *pfd = xnmalloc (n, sizeof *pfd);
+  int pending = n;
+  struct timespec start;
+  stats_start (&start);
 
-  output_type = changed;
-  verbose_output = false;
-  recoverable_output = false;
+  for (int i = 0; i < n; i++)
+    {
+      rfc2217_resolve (&ports[i]);
+      rfc2217_start_connect (&ports[i]);
+    }
 
-  opterr = 0;
+  struct timespec deadline;
+  deadline_from_ms (&deadline, cpo_timeout ());
 
-  while ((optc = getopt_long (argc - argi, argv + argi, "-agF:",
-                              longopts, nullptr))
-         != -1)
+  while (pending)
     {
-      if (process_option(optc, &verbose_output, &recoverable_output, 
-                        &output_type, &file_name, &noargs, 
-                        argv, &argi, &opti))
+      for (int i = 0; i < n; i++)
+        {
+          pfd[i].fd = ports[i].connected ? -1 : ports[i].fd;
+          pfd[i].events = POLLOUT;
+        }
+      int left = ms_until (&deadline);
+      int r = left == 0 ? 0 : poll (pfd, n, left);
+      if (r < 0 && errno == EINTR)
         continue;
-      
-      while (opti < optind)
-        argv[argi + opti++] = nullptr;
+      if (r <= 0)
+        {
+          int i = 0;
+          while (pfd[i].fd < 0)
+            i++;
+          error (EXIT_FAILURE, r < 0 ? errno : ETIMEDOUT, "%s",
+                 quotef (ports[i].address));
+        }
+
+      for (int i = 0; i < n; i++)
+        if (0 <= pfd[i].fd && pfd[i].revents)
+          {
+            struct rfc2217_port *p = &ports[i];
+            int err;
+            socklen_t errlen = sizeof err;
+            if (getsockopt (p->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0)
+              err = errno;
+            if (err)
+              {
+                p->err = err;
+                close (p->fd);
+                p->addr = p->addr->ai_next;
+                rfc2217_start_connect (p);
+                continue;
+              }
+
+            p->connected = true;
+            pending--;
+            freeaddrinfo (p->addrs);
+            int one = 1;
+            setsockopt (p->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            int flags = fcntl (p->fd, F_GETFL);
+            static unsigned char const will[] =
+              { TELNET_IAC, TELNET_WILL, COM_PORT_OPTION };
+            if (flags < 0
+                || fcntl (p->fd, F_SETFL, flags & ~O_NONBLOCK) != 0
+                || full_write (p->fd, will, sizeof will) != sizeof will)
+              error (EXIT_FAILURE, errno, "%s", quotef (p->address));
+            stats_device = p->stats;
+            stats_stop (stat_open, &start);
+          }
     }
+  free (pfd);
+}
 
-  validate_options(verbose_output, recoverable_output, noargs);
+/* Make the port P standard input, where the backend expects it, with
+   its settings as last read or confirmed.  */
 
-  device_name = file_name ? file_name : _("standard input");
+static void
+rfc2217_select (struct rfc2217_port *p)
+{
+  if (p->fd != STDIN_FILENO && dup2 (p->fd, STDIN_FILENO) < 0)
+    error (EXIT_FAILURE, errno, "%s", quotef (p->address));
+  backend = &rfc2217_backend;
+  cpo_mode = p->mode;
+  cpo_mode_valid = true;
+  stats_device = p->stats;
+  forget_driver_settings ();
+}
 
-  if (!noargs && !verbose_output && !recoverable_output)
+/* For each comma-separated terminal server address in TARGETS, print
+   the settings of its port if DISPLAY, in OUTPUT_TYPE, or else apply
+   the settings in ARGV to it.  The ports are read, and then changed,
+   in one round trip for all; only modem line changes take one more
+   round trip per port.  */
+
+static void
+run_rfc2217 (char *targets, enum output_type output_type, bool display,
+             char **argv, int argc)
+{
+  /* A server that closes the connection is then reported, as EPIPE
+     with its address, rather than killing us silently.  */
+  signal (SIGPIPE, SIG_IGN);
+
+  int n = 1;
+  for (char const *p = targets; (p = strchr (p, ',')); p++)
+    n++;
+  struct rfc2217_port *ports = xcalloc (n, sizeof *ports);
+  n = 0;
+  for (char *address = strtok (targets, ","); address;
+       address = strtok (nullptr, ","))
     {
-      static struct termios check_mode;
-      apply_settings (true, device_name, argv, argc,
-                      &check_mode, &require_set_attr);
+      ports[n].address = address;
+      ports[n].stats = stats_new_device (address);
+      n++;
+    }
+  if (n == 0)
+    error (EXIT_FAILURE, 0, _("invalid terminal server address %s"),
+           quote (targets));
+
+  rfc2217_connect_ports (ports, n);
+  for (int i = 0; i < n; i++)
+    rfc2217_query (&ports[i].batch);
+  cpo_exchange_ports (ports, n, stat_tcgetattr);
+  for (int i = 0; i < n; i++)
+    {
+      default_mode (&ports[i].mode);
+      cpo_store (&ports[i].mode, &ports[i].batch);
     }
 
-  if (file_name)
-    open_device_file(device_name);
-
-  if (tcgetattr (STDIN_FILENO, &mode))
-    error (EXIT_FAILURE, errno, "%s", quotef (device_name));
-
-  if (verbose_output || recoverable_output || noargs)
+  if (display)
     {
-      max_col = screen_columns ();
-      current_col = 0;
-      display_settings (output_type, &mode, device_name);
-      return EXIT_SUCCESS;
+      for (int i = 0; i < n; i++)
+        {
+          rfc2217_select (&ports[i]);
+          if (1 < n && output_type != json)
+            printf ("%s:\n", ports[i].address);
+          max_col = screen_columns ();
+          current_col = 0;
+          display_settings (output_type, &ports[i].mode, ports[i].address);
+        }
+      return;
     }
 
-  require_set_attr = false;
-  apply_settings (false, device_name, argv, argc,
-                  &mode, &require_set_attr);
+  for (int i = 0; i < n; i++)
+    {
+      struct rfc2217_port *p = &ports[i];
+      bool require_set_attr = false;
+      rfc2217_select (p);
+      p->request = p->mode;
+      apply_settings (false, p->address, argv, argc, &p->request,
+                      &require_set_attr);
+      perform_tty_actions (true, p->address);
+      p->batch.n = 0;
+      if (require_set_attr)
+        rfc2217_request (&p->batch, &p->request);
+    }
 
-  if (require_set_attr)
-    apply_and_verify_settings(&mode, device_name);
+  cpo_exchange_ports (ports, n, stat_tcsetattr);
 
-  return EXIT_SUCCESS;
+  for (int i = 0; i < n; i++)
+    {
+      struct rfc2217_port *p = &ports[i];
+      if (p->batch.n)
+        {
+          rfc2217_confirm (&p->mode, &p->request, &p->batch);
+          if (! eq_mode (&p->request, &p->mode))
+            {
+              if (dev_debug)
+                {
+                  struct mode_diff diff;
+                  diff_modes (&p->request, &p->mode, &diff);
+                  print_mode_differences (&p->request, &p->mode, &diff);
+                }
+              error (EXIT_FAILURE, 0,
+                     _("%s: unable to perform all requested operations"),
+                     quotef (p->address));
+            }
+        }
+      rfc2217_select (p);
+      perform_tty_actions (false, p->address);
+    }
 }
 
-static bool
-process_option(int optc, bool *verbose_output, bool *recoverable_output,
-              enum output_type *output_type, char **file_name, 
-              bool *noargs, char **argv, int *argi, int *opti)
+/* Take an exclusive flock on the device, so that other instances
+   using --lock do not interleave their changes with ours.  The lock
+   goes away when we exit.  Unless -F opened the device, standard input
+   may share its open file description with other processes started
+   from the same shell, and they would all hold a lock on it; so open
+   the device again by name, if FILE_NAME is null, and lock that.
+   Without a time limit, block for the lock; otherwise poll for it
+   with backoff, so lock_timeout can be honored.  */
+
+static void
+lock_device_file (char const *file_name, char const *device_name)
 {
-  switch (optc)
+  struct timespec start, deadline;
+  double backoff = 0.001;
+  int fd = STDIN_FILENO;
+
+  if (!file_name)
     {
-    case 'a':
-      *verbose_output = true;
-      *output_type = all;
-      return true;
+      char const *tty = ttyname (STDIN_FILENO);
+      if (!tty)
+        error (EXIT_FAILURE, errno, _("%s: cannot lock device"),
+               quotef (device_name));
+      /* Left open until exit, as closing it would drop the lock.  */
+      fd = open (tty, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+      if (fd < 0)
+        error (EXIT_FAILURE, errno, _("%s: cannot lock device"),
+               quotef (tty));
+    }
 
-    case 'g':
-      *recoverable_output = true;
-      *output_type = recoverable;
-      return true;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  deadline_from_ms (&deadline, lock_timeout);
 
-    case 'F':
-      if (*file_name)
-        error (EXIT_FAILURE, 0, _("only one device may be specified"));
-      *file_name = optarg;
-      return true;
+  while (true)
+    {
+      struct timespec call;
+      stats_start (&call);
+      int ret = flock (fd, lock_timeout < 0 ? LOCK_EX : LOCK_EX | LOCK_NB);
+      stats_stop (stat_lock, &call);
+      if (ret == 0)
+        {
+          if (dev_debug)
+            error (0, 0, _("%s: locked in %jd ms"),
+                   quotef (device_name), ms_since (&start));
+          return;
+        }
+      if (errno == EINTR)
+        continue;
+      if (errno != EWOULDBLOCK)
+        error (EXIT_FAILURE, errno, _("%s: cannot lock device"),
+               quotef (device_name));
 
-    case DEV_DEBUG_OPTION:
-      dev_debug = true;
-      return true;
+      int left = ms_until (&deadline);
+      if (left == 0)
+        error (EXIT_FAILURE, 0,
+               _("%s: still locked by another process after %jd ms"),
+               quotef (device_name), ms_since (&start));
+      xnanosleep (MIN (backoff, left / 1000.0));
+      backoff = MIN (backoff * 2, 0.064);
+    }
+}
 
-    case_GETOPT_HELP_CHAR;
+/* Wait at most drain_timeout milliseconds for the output queue to empty,
+   polling TIOCOUTQ with exponential backoff, so a port stuck under
+   XOFF or with CTS deasserted cannot hang tcsetattr (TCSADRAIN).
+   Return the tcsetattr action to use given drain_policy.  */
 
-    case_GETOPT_VERSION_CHAR (PROGRAM_NAME, AUTHORS);
+static int
+drain_output (char const *device_name)
+{
+#ifdef TIOCOUTQ
+  struct timespec start, deadline;
+  double backoff = 0.001;
+  int pending;
 
-    default:
-      if (! STREQ (argv[*argi + *opti], "-drain")
-          && ! STREQ (argv[*argi + *opti], "drain"))
-        *noargs = false;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  deadline_from_ms (&deadline, drain_timeout);
 
-      *argi += *opti;
-      *opti = 1;
-      optind = 0;
-      return false;
+  while (true)
+    {
+      /* Not timed_ioctl: these polls are part of the drain time.  */
+      if (backend->control (STDIN_FILENO, TIOCOUTQ, &pending) != 0)
+        {
+          /* Can't see the queue; fall back to an unbounded drain.  */
+          if (dev_debug)
+            error (0, errno, _("%s: cannot query output queue"),
+                   quotef (device_name));
+          return TCSADRAIN;
+        }
+      if (pending == 0)
+        {
+          if (dev_debug)
+            error (0, 0, _("%s: output drained in %jd ms"),
+                   quotef (device_name), ms_since (&start));
+          /* Only the transmit shift register may still be busy.  */
+          return TCSADRAIN;
+        }
+
+      int left = ms_until (&deadline);
+      if (left == 0)
+        break;
+      xnanosleep (MIN (backoff, left / 1000.0));
+      backoff = MIN (backoff * 2, 0.064);
     }
-}
 
-static void
-validate_options(bool verbose_output, bool recoverable_output, bool noargs)
-{
-  if (verbose_output && recoverable_output)
-    error (EXIT_FAILURE, 0,
-           _("the options for verbose and stty-readable output styles are\n"
-             "mutually exclusive"));
+  switch (drain_policy)
+    {
+    case drain_fail:
+      error (EXIT_FAILURE, 0,
+             _("%s: output not drained after %jd ms (%d bytes pending)"),
+             quotef (device_name), ms_since (&start), pending);
+      break;
 
-  if (!noargs && (verbose_output || recoverable_output))
-    error (EXIT_FAILURE, 0,
-           _("when specifying an output style, modes may not be set"));
+    case drain_flush:
+      error (0, 0, _("%s: output not drained after %jd ms;"
+                     " discarding %d pending bytes"),
+             quotef (device_name), ms_since (&start), pending);
+      if (tcflush (STDIN_FILENO, TCIOFLUSH) != 0)
+        error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+      break;
+
+    case drain_now:
+      error (0, 0, _("%s: output not drained after %jd ms;"
+                     " applying settings immediately"),
+             quotef (device_name), ms_since (&start));
+      break;
+    }
+  return TCSANOW;
+#else
+  return TCSADRAIN;
+#endif
 }
 
+/* Perform those of the requested queue flushing and flow control
+   actions that go BEFORE applying the settings, or else the rest,
+   along with the modem control line changes if --modem-order says so.
+   Discarding output and stopping the peer come first, so that neither
+   holds up the change; discarding input comes after, so that input
+   received under the old settings is dropped as well.  */
+
 static void
-open_device_file(char const *device_name)
+perform_tty_actions (bool before, char const *device_name)
 {
-  int fdflags;
-  if (fd_reopen (STDIN_FILENO, device_name, O_RDONLY | O_NONBLOCK, 0) < 0)
-    error (EXIT_FAILURE, errno, "%s", quotef (device_name));
-  if ((fdflags = fcntl (STDIN_FILENO, F_GETFL)) == -1
-      || fcntl (STDIN_FILENO, F_SETFL, fdflags & ~O_NONBLOCK) < 0)
-    error (EXIT_FAILURE, errno, _("%s: couldn't reset non-blocking mode"),
-           quotef (device_name));
+  static struct
+  {
+    int action;
+    bool before;
+    bool flow;
+    int arg;
+  } const steps[] =
+  {
+    {ACT_OFLUSH, true, false, TCOFLUSH},
+    {ACT_IOFF, true, true, TCIOFF},
+    {ACT_IFLUSH, false, false, TCIFLUSH},
+    {ACT_OOFF, false, true, TCOOFF},
+    {ACT_OON, false, true, TCOON},
+    {ACT_ION, false, true, TCION},
+  };
+
+  for (int i = 0; i < countof (steps); i++)
+    if ((tty_actions & steps[i].action) && steps[i].before == before
+        && (steps[i].flow
+            ? tcflow (STDIN_FILENO, steps[i].arg)
+            : tcflush (STDIN_FILENO, steps[i].arg)) != 0)
+      error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+
+  if (before == modem_before)
+    set_modem_lines (device_name);
 }
 
-static void
-apply_and_verify_settings(struct termios *mode, char const *device_name)
+/* Apply MODE to the device and read it back.  Return true if the device
+   took all of it.  Otherwise store what it did not take into *DIFF, so
+   the caller can report it or retry with the supported subset.  */
+
+static bool
+apply_and_verify_settings (struct termios *mode, char const *device_name,
+                           struct mode_diff *diff)
 {
   static struct termios new_mode;
+  int action = tcsetattr_options;
+
+  if (action != TCSANOW && 0 <= drain_timeout)
+    {
+      struct timespec start;
+      stats_start (&start);
+      if (drain_output (device_name) == TCSANOW)
+        action = TCSANOW;
+      stats_stop (stat_drain, &start);
+    }
 
-  if (tcsetattr (STDIN_FILENO, tcsetattr_options, mode))
+  if (timed_tcsetattr (STDIN_FILENO, action, mode))
     error (EXIT_FAILURE, errno, "%s", quotef (device_name));
 
-  if (tcgetattr (STDIN_FILENO, &new_mode))
+  if (timed_tcgetattr (STDIN_FILENO, &new_mode))
     error (EXIT_FAILURE, errno, "%s", quotef (device_name));
 
-  if (! eq_mode (mode, &new_mode))
-    {
-      if (dev_debug)
-        print_mode_differences(mode, &new_mode);
+  if (eq_mode (mode, &new_mode))
+    return true;
 
-      error (EXIT_FAILURE, 0,
-             _("%s: unable to perform all requested operations"),
-             quotef (device_name));
+  diff_modes (mode, &new_mode, diff);
+  if (dev_debug)
+    print_mode_differences (mode, &new_mode, diff);
+  return false;
+}
+
+/* Store into *DIFF the parts of REQUESTED that differ in ACTUAL.  */
+
+static void
+diff_modes (struct termios const *requested, struct termios const *actual,
+            struct mode_diff *diff)
+{
+  diff->iflag = requested->c_iflag ^ actual->c_iflag;
+  diff->oflag = requested->c_oflag ^ actual->c_oflag;
+  diff->cflag = requested->c_cflag ^ actual->c_cflag;
+  diff->lflag = requested->c_lflag ^ actual->c_lflag;
+  for (size_t i = 0; i < NCCS; i++)
+    diff->cc[i] = requested->c_cc[i] != actual->c_cc[i];
+  diff->ispeed = cfgetispeed (requested) != cfgetispeed (actual);
+  diff->ospeed = cfgetospeed (requested) != cfgetospeed (actual);
+#ifdef HAVE_C_LINE
+  diff->line = requested->c_line != actual->c_line;
+#endif
+}
+
+/* Return the member of DIFF corresponding to flag word TYPE.  */
+
+static tcflag_t
+mode_diff_flag (struct mode_diff const *diff, enum mode_type type)
+{
+  switch (type)
+    {
+    case control:
+      return diff->cflag;
+    case input:
+      return diff->iflag;
+    case output:
+      return diff->oflag;
+    case local:
+      return diff->lflag;
+    default:
+      return 0;
     }
 }
 
+/* Diagnose, setting by setting, the parts of MODE that
+   the device did not apply, as recorded in DIFF.  */
+
 static void
-print_mode_differences(struct termios *mode, struct termios *new_mode)
+print_mode_differences (struct termios const *mode,
+                        struct termios const *new_mode,
+                        struct mode_diff const *diff)
 {
-  error (0, 0, _("indx: mode: actual mode"));
-  for (unsigned int i = 0; i < sizeof (*new_mode); i++)
+  static char const *const flag_name[] =
+    { "c_cflag", "c_iflag", "c_oflag", "c_lflag" };
+  tcflag_t unnamed[] = { diff->cflag, diff->iflag, diff->oflag, diff->lflag };
+  bool cc_named[NCCS] = { false, };
+
+  for (int i = 0; mode_info[i].name != nullptr; ++i)
+    {
+      struct mode_info const *info = &mode_info[i];
+      tcflag_t differ = mode_diff_flag (diff, info->type);
+      unsigned long mask = info->mask ? info->mask : info->bits;
+      if (info->type == combination || (differ & mask) == 0)
+        continue;
+      unnamed[info->type] &= ~mask;
+
+      /* Only name the aliases and field values that flipped.  */
+      tcflag_t req = *mode_type_flag (info->type, (struct termios *) mode);
+      tcflag_t act = *mode_type_flag (info->type,
+                                      (struct termios *) new_mode);
+      bool want = (req & mask) == info->bits;
+      if (want == ((act & mask) == info->bits) || (info->flags & OMIT))
+        continue;
+      error (0, 0, _("requested %s%s, actual %s%s"),
+             want ? "" : "-", info->name, want ? "-" : "", info->name);
+    }
+
+  /* Speeds are reported separately below.  */
+#ifdef CBAUD
+  unnamed[control] &= ~CBAUD;
+#endif
+#ifdef CIBAUD
+  unnamed[control] &= ~CIBAUD;
+#endif
+
+  for (int t = control; t < combination; t++)
+    if (unnamed[t])
+      error (0, 0, _("%s: unnamed bits %#lx differ"),
+             flag_name[t], (unsigned long int) unnamed[t]);
+
+  for (int i = 0; control_info[i].name != nullptr; ++i)
     {
-      unsigned int newc = *(((unsigned char *) new_mode) + i);
-      unsigned int oldc = *(((unsigned char *) mode) + i);
-      error (0, 0, "0x%02x, 0x%02x: 0x%02x%s", i, oldc, newc,
-              newc == oldc ? "" : " *");
+      size_t off = control_info[i].offset;
+      if (!diff->cc[off] || cc_named[off])
+        continue;
+      cc_named[off] = true;
+      if (STREQ (control_info[i].name, "min")
+          || STREQ (control_info[i].name, "time"))
+        {
+          error (0, 0, _("requested %s %u, actual %u"), control_info[i].name,
+                 (unsigned int) mode->c_cc[off],
+                 (unsigned int) new_mode->c_cc[off]);
+          continue;
+        }
+      /* visible returns a static buffer, so copy the first result.  */
+      char requested[sizeof "<undef>"];
+      strcpy (requested, visible (mode->c_cc[off]));
+      error (0, 0, _("requested %s %s, actual %s"), control_info[i].name,
+             requested, visible (new_mode->c_cc[off]));
     }
+  for (size_t i = 0; i < NCCS; i++)
+    if (diff->cc[i] && !cc_named[i])
+      error (0, 0, _("c_cc[%zu]: requested %#x, actual %#x"), i,
+             (unsigned int) mode->c_cc[i], (unsigned int) new_mode->c_cc[i]);
+
+  if (diff->ispeed)
+    error (0, 0, _("requested ispeed %lu, actual %lu"),
+           baud_to_value (cfgetispeed (mode)),
+           baud_to_value (cfgetispeed (new_mode)));
+  if (diff->ospeed)
+    error (0, 0, _("requested ospeed %lu, actual %lu"),
+           baud_to_value (cfgetospeed (mode)),
+           baud_to_value (cfgetospeed (new_mode)));
+#ifdef HAVE_C_LINE
+  if (diff->line)
+    error (0, 0, _("requested line %d, actual %d"),
+           mode->c_line, new_mode->c_line);
+#endif
 }
 
 /* Return true if modes are equivalent.  */
@@ -1915,23 +5116,115 @@ static void set_input_speed(speed_t baud, const char *arg, struct termios *mode)
         error(EXIT_FAILURE, 0, _("unsupported ispeed %s"), quoteaf(arg));
 }
 
-static void set_output_speed(speed_t baud, const char *arg, struct termios *mode)
+static void set_output_speed(speed_t baud, const char *arg, struct termios *mode)
+{
+    last_obaud = baud;
+    if (cfsetospeed(mode, baud))
+        error(EXIT_FAILURE, 0, _("unsupported ospeed %s"), quoteaf(arg));
+}
+
+static void set_speed(enum speed_setting type, char const *arg, struct termios *mode)
+{
+    speed_t baud = string_to_baud(arg);
+    affirm(baud != (speed_t) -1);
+
+    if (type == input_speed || type == both_speeds)
+        set_input_speed(baud, arg, mode);
+    
+    if (type == output_speed || type == both_speeds)
+        set_output_speed(baud, arg, mode);
+}
+
+/* Return the number of data bits per character in MODE.  */
+
+static int
+char_bits (struct termios const *mode)
+{
+  switch (mode->c_cflag & CSIZE)
+    {
+    case CS5:
+      return 5;
+    case CS6:
+      return 6;
+    case CS7:
+      return 7;
+    default:
+      return 8;
+    }
+}
+
+/* Return the number of bits sent on the line per character in MODE,
+   counting the start bit, data bits, parity bit and stop bits.  */
+
+static int
+frame_bits (struct termios const *mode)
+{
+  int bits = 1 + char_bits (mode);
+
+  if (mode->c_cflag & PARENB)
+    bits++;
+  bits += mode->c_cflag & CSTOPB ? 2 : 1;
+  return bits;
+}
+
+/* Return how many characters of text per second fit in CHARS characters
+   per second on the line with the output processing of MODE.  With opost
+   and onlcr each newline is sent as two characters; text is taken to be
+   in lines of TEXT_LINE characters, counting the newline.  */
+
+enum { TEXT_LINE = 80 };
+
+static unsigned long int
+text_chars (struct termios const *mode, unsigned long int chars)
+{
+#ifdef ONLCR
+  if ((mode->c_oflag & (OPOST | ONLCR)) == (OPOST | ONLCR))
+    return chars * TEXT_LINE / (TEXT_LINE + 1);
+#endif
+  return chars;
+}
+
+/* Return the line speed of MODE in bits per second for received data,
+   or 0 if it is not known.  An input speed of 0 means "same as output".  */
+
+static unsigned long int
+line_baud (struct termios const *mode)
 {
-    last_obaud = baud;
-    if (cfsetospeed(mode, baud))
-        error(EXIT_FAILURE, 0, _("unsupported ospeed %s"), quoteaf(arg));
+  speed_t ispeed = cfgetispeed (mode);
+  return baud_to_value (ispeed ? ispeed : cfgetospeed (mode));
 }
 
-static void set_speed(enum speed_setting type, char const *arg, struct termios *mode)
+/* Convert the "latency" and "batch" settings, if given, to VMIN and
+   VTIME in MODE.  VMIN is the batch size, or else the number of
+   characters that can arrive within the latency.  VTIME, the
+   inter-character timer, is the latency rounded up to its tenth of a
+   second granularity, but never shorter than two character times, so
+   a slow line does not split a burst across reads.  A latency of 0
+   asks for no timer at all: VTIME is 0.  */
+
+static void
+set_read_timing (struct termios *mode)
 {
-    speed_t baud = string_to_baud(arg);
-    affirm(baud != (speed_t) -1);
+  unsigned long int baud = line_baud (mode);
+  uintmax_t char_us = baud ? (frame_bits (mode) * UINTMAX_C (1000000)
+                              + baud - 1) / baud
+                           : 0;
 
-    if (type == input_speed || type == both_speeds)
-        set_input_speed(baud, arg, mode);
-    
-    if (type == output_speed || type == both_speeds)
-        set_output_speed(baud, arg, mode);
+  if (0 <= read_batch)
+    mode->c_cc[VMIN] = read_batch;
+
+  if (0 <= read_latency)
+    {
+      uintmax_t latency_us = read_latency * UINTMAX_C (1000);
+      if (read_batch < 0)
+        mode->c_cc[VMIN] = (char_us
+                            ? MAX (1, MIN (latency_us / char_us,
+                                           TYPE_MAXIMUM (cc_t)))
+                            : 1);
+      uintmax_t ds = (read_latency == 0 ? 0
+                      : (MAX (latency_us, 2 * char_us) + 99999) / 100000);
+      mode->c_cc[VTIME] = MIN (ds, TYPE_MAXIMUM (cc_t));
+    }
 }
 
 #ifdef TIOCGWINSZ
@@ -1939,7 +5232,7 @@ static void set_speed(enum speed_setting type, char const *arg, struct termios *
 static int
 get_win_size (int fd, struct winsize *win)
 {
-  int err = ioctl (fd, TIOCGWINSZ, (char *) win);
+  int err = timed_ioctl (fd, TIOCGWINSZ, win);
   return err;
 }
 
@@ -1992,16 +5285,16 @@ set_window_size (int rows, int cols, char const *device_name)
       win.ws_row = 1;
       win.ws_col = 1;
 
-      if (ioctl (STDIN_FILENO, TIOCSWINSZ, (char *) &win))
+      if (timed_ioctl (STDIN_FILENO, TIOCSWINSZ, &win))
         error (EXIT_FAILURE, errno, "%s", quotef (device_name));
 
-      if (ioctl (STDIN_FILENO, TIOCSSIZE, (char *) &ttysz))
+      if (timed_ioctl (STDIN_FILENO, TIOCSSIZE, &ttysz))
         error (EXIT_FAILURE, errno, "%s", quotef (device_name));
       return;
     }
 # endif
 
-  if (ioctl (STDIN_FILENO, TIOCSWINSZ, (char *) &win))
+  if (timed_ioctl (STDIN_FILENO, TIOCSWINSZ, &win))
     error (EXIT_FAILURE, errno, "%s", quotef (device_name));
 }
 
@@ -2026,8 +5319,698 @@ display_window_size (bool fancy, char const *device_name)
       if (!fancy)
         current_col = 0;
     }
-}
+}
+#endif
+
+/* Block until the window size of the terminal changes, and print the
+   new size in the same format as "stty size".  If HOW is size_wait_watch,
+   keep printing a line per change.  SIGWINCH is only sent for the
+   controlling terminal, so other devices will never report a change.
+   Exit with failure if --timeout expires before any change was seen
+   with --wait-size; with --watch-size the timeout ends the watch.  */
+
+static void
+wait_window_size (enum size_wait how, char const *device_name)
+{
+#if defined TIOCGWINSZ && HAVE_SYS_SIGNALFD_H
+  sigset_t winch;
+  struct winsize prev;
+  struct timespec deadline;
+
+  sigemptyset (&winch);
+  sigaddset (&winch, SIGWINCH);
+  /* Block the signal before the first size query,
+     so a change in between is not lost.  */
+  if (sigprocmask (SIG_BLOCK, &winch, nullptr) != 0)
+    error (EXIT_FAILURE, errno, _("failed to block SIGWINCH"));
+  int sfd = signalfd (-1, &winch, SFD_CLOEXEC);
+  if (sfd < 0)
+    error (EXIT_FAILURE, errno, _("failed to create signal descriptor"));
+
+  if (get_win_size (STDIN_FILENO, &prev))
+    {
+      if (errno != EINVAL)
+        error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+      memset (&prev, 0, sizeof prev);
+    }
+
+  deadline_from_ms (&deadline, wait_timeout);
+  max_col = screen_columns ();
+  current_col = 0;
+
+  while (true)
+    {
+      struct pollfd pfd = { .fd = sfd, .events = POLLIN };
+      int n = poll (&pfd, 1, ms_until (&deadline));
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          error (EXIT_FAILURE, errno, _("failed to wait for SIGWINCH"));
+        }
+      if (n == 0)
+        {
+          if (how == size_wait_once)
+            error (EXIT_FAILURE, 0,
+                   _("%s: timed out waiting for a size change"),
+                   quotef (device_name));
+          return;
+        }
+
+      struct signalfd_siginfo si;
+      if (read (sfd, &si, sizeof si) != sizeof si && errno != EAGAIN)
+        error (EXIT_FAILURE, errno, _("failed to read SIGWINCH"));
+
+      /* Several resizes may be coalesced into one signal, and some
+         terminals signal without an actual change; only report
+         when the size differs from the last one printed.  */
+      struct winsize win;
+      if (get_win_size (STDIN_FILENO, &win))
+        error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+      if (win.ws_row == prev.ws_row && win.ws_col == prev.ws_col)
+        continue;
+      prev = win;
+
+      display_window_size (false, device_name);
+      if (how == size_wait_once)
+        return;
+      if (fflush (stdout) != 0)
+        error (EXIT_FAILURE, errno, _("write error"));
+    }
+#else
+  error (EXIT_FAILURE, 0,
+         _("%s: waiting for size changes is not supported on this system"),
+         quotef (device_name));
+#endif
+}
+
+/* Give the devices named by the non-null elements of ARGV[1..ARGC-1]
+   the size in broadcast_size_arg, or else that of standard input, called
+   DEVICE_NAME.  All devices are opened first, so the changes themselves
+   are one TIOCSWINSZ each, with stagger_ms spread evenly between them.
+   Diagnose each device that fails and carry on with the rest; return
+   the exit status.  */
+
+static int
+broadcast_window_size (char const *device_name, int argc, char **argv)
+{
+#ifdef TIOCGWINSZ
+  struct winsize win;
+  int status = EXIT_SUCCESS;
+
+  if (broadcast_size_arg)
+    {
+      char const *arg = broadcast_size_arg;
+      char *end;
+      errno = 0;
+      unsigned long int rows = strtoul (arg, &end, 10), cols = 0;
+      bool ok = c_isdigit (arg[0]) && *end == 'x' && c_isdigit (end[1]);
+      if (ok)
+        {
+          cols = strtoul (end + 1, &end, 10);
+          ok = !errno && !*end && rows <= USHRT_MAX && cols <= USHRT_MAX;
+        }
+      if (!ok)
+        error (EXIT_FAILURE, 0, _("invalid window size %s"),
+               quote (broadcast_size_arg));
+      memset (&win, 0, sizeof win);
+      win.ws_row = rows;
+      win.ws_col = cols;
+    }
+  else if (get_win_size (STDIN_FILENO, &win))
+    error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+
+  struct target
+  {
+    int fd;
+    char const *name;
+    struct device_stats *stats;
+  } *dst = xnmalloc (argc, sizeof *dst);
+  int n = 0;
+
+  for (int i = 1; i < argc; i++)
+    if (argv[i])
+      {
+        struct device_stats *stats = stats_new_device (argv[i]);
+        struct timespec start;
+        stats_start (&start);
+        int fd = open (argv[i], O_RDONLY | O_NONBLOCK | O_NOCTTY);
+        stats_stop (stat_open, &start);
+        if (fd < 0)
+          {
+            error (0, errno, "%s", quotef (argv[i]));
+            status = EXIT_FAILURE;
+          }
+        else
+          dst[n++] = (struct target) { fd, argv[i], stats };
+      }
+
+  if (n == 0 && status == EXIT_SUCCESS)
+    error (EXIT_FAILURE, 0, _("no devices to resize"));
+
+  for (int i = 0; i < n; i++)
+    {
+      if (i && stagger_ms)
+        xnanosleep (stagger_ms / 1000.0 / n);
+      stats_device = dst[i].stats;
+      if (timed_ioctl (dst[i].fd, TIOCSWINSZ, &win) != 0)
+        {
+          error (0, errno, "%s", quotef (dst[i].name));
+          status = EXIT_FAILURE;
+        }
+      close (dst[i].fd);
+    }
+
+  return status;
+#else
+  error (EXIT_FAILURE, 0,
+         _("%s: window sizes are not supported on this system"),
+         quotef (device_name));
+  return EXIT_FAILURE;
+#endif
+}
+
+#ifdef TIOCGWINSZ
+/* Milliseconds to wait for the terminal to answer --probe-size,
+   unless --timeout says otherwise.  */
+enum { PROBE_TIMEOUT_MS = 1000 };
+
+/* The queries --probe-size sends in one write: the xterm window size
+   report CSI 18 t, which fewer terminals answer; then, between saving
+   and restoring the cursor, a move as far down and right as it goes
+   and a cursor position report CSI 6 n, which nearly all answer.
+   Replies come in order, so once the position arrives, any size
+   report has arrived before it.  */
+static char const probe_query[] = "\033[18t\0337\033[999;999H\033[6n\0338";
+
+/* The settings to restore if --probe-size exits early, if nonnull.  */
+static struct termios const *probe_saved_mode;
+
+static void
+probe_restore (void)
+{
+  if (probe_saved_mode)
+    tcsetattr (STDIN_FILENO, TCSANOW, probe_saved_mode);
+}
+#endif
+
+/* Ask the terminal at the other end of standard input, whose settings
+   are MODE, for its size with one round trip of escape sequences, as
+   for serial consoles where the kernel does not know it.  FILE_NAME is
+   the device given with -F, or null.  Store the answer with
+   set_window_size, print it, and restore MODE.  */
+
+static void
+probe_window_size (struct termios const *mode, char const *file_name,
+                   char const *device_name)
+{
+#ifdef TIOCGWINSZ
+  struct termios raw = *mode;
+  raw.c_lflag &= ~(ICANON | ECHO | ECHONL | ISIG | IEXTEN);
+  raw.c_iflag &= ~(IXON | ICRNL | INLCR | IGNCR | ISTRIP);
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 0;
+
+  /* Standard input is read-only with -F, and may be otherwise.  */
+  int out = STDIN_FILENO;
+  int acc = timed_fcntl (STDIN_FILENO, F_GETFL, 0);
+  if (acc < 0 || (acc & O_ACCMODE) != O_RDWR)
+    {
+      char const *name = file_name ? file_name : ttyname (STDIN_FILENO);
+      out = name ? open (name, O_WRONLY | O_NOCTTY) : -1;
+    }
+  if (out < 0)
+    error (EXIT_FAILURE, errno, _("%s: cannot open for writing"),
+           quotef (device_name));
+
+  struct timespec deadline;
+  deadline_from_ms (&deadline, 0 <= wait_timeout ? wait_timeout
+                                                 : PROBE_TIMEOUT_MS);
+
+  /* Drop stale input, so it is not taken for a reply.  */
+  if (timed_tcsetattr (STDIN_FILENO, TCSAFLUSH, &raw) != 0)
+    error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+  probe_saved_mode = mode;
+  atexit (probe_restore);
+  if (full_write (out, probe_query, sizeof probe_query - 1)
+      != sizeof probe_query - 1)
+    error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+
+  char buf[128];
+  size_t len = 0;
+  unsigned int rows = 0, cols = 0;
+
+  while (true)
+    {
+      struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+      int left = ms_until (&deadline);
+      int n = left == 0 ? 0 : poll (&pfd, 1, left);
+      if (n < 0 && errno != EINTR)
+        error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+      if (n == 0)
+        error (EXIT_FAILURE, 0, _("%s: no reply to the size query"),
+               quotef (device_name));
+      if (n < 0)
+        continue;
+
+      ssize_t r = read (STDIN_FILENO, buf + len, sizeof buf - 1 - len);
+      if (r < 0 && errno != EAGAIN && errno != EINTR)
+        error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+      if (r <= 0)
+        continue;
+      len += r;
+      buf[len] = '\0';
+
+      /* Look at each complete control sequence: a size report is
+         CSI 8 ; ROWS ; COLS t, a position report CSI ROW ; COL R.  */
+      char *p = buf;
+      char *esc;
+      bool reported = false;
+      while ((esc = strstr (p, "\033[")))
+        {
+          char *end = esc + 2 + strspn (esc + 2, "0123456789;");
+          if (!*end)
+            break;
+          unsigned int a, b;
+          int used;
+          if (*end == 't' && sscanf (esc + 2, "8;%u;%ut%n", &a, &b, &used) == 2
+              && esc + 2 + used == end + 1)
+            rows = a, cols = b;
+          else if (*end == 'R'
+                   && sscanf (esc + 2, "%u;%uR%n", &a, &b, &used) == 2
+                   && esc + 2 + used == end + 1)
+            {
+              if (!rows || !cols)
+                rows = a, cols = b;
+              reported = true;
+            }
+          /* A sequence cut short by another starts over there.  */
+          p = *end == '\033' ? end : end + 1;
+        }
+      if (reported)
+        break;
+
+      /* Keep any incomplete sequence; drop the rest.  */
+      esc = strstr (p, "\033");
+      if (!esc)
+        esc = buf + len;
+      len -= esc - buf;
+      memmove (buf, esc, len);
+      if (len == sizeof buf - 1)
+        error (EXIT_FAILURE, 0, _("%s: invalid reply to the size query"),
+               quotef (device_name));
+    }
+
+  probe_saved_mode = nullptr;
+  if (timed_tcsetattr (STDIN_FILENO, TCSANOW, mode) != 0)
+    error (EXIT_FAILURE, errno, "%s", quotef (device_name));
+  if (out != STDIN_FILENO)
+    close (out);
+
+  if (rows == 0 || cols == 0 || USHRT_MAX < rows || USHRT_MAX < cols)
+    error (EXIT_FAILURE, 0, _("%s: invalid reply to the size query"),
+           quotef (device_name));
+  set_window_size (rows, cols, device_name);
+  display_window_size (false, device_name);
+#else
+  error (EXIT_FAILURE, 0,
+         _("%s: window sizes are not supported on this system"),
+         quotef (device_name));
+#endif
+}
+
+/* Store the number of bytes waiting in the input and output queues
+   of the terminal FD into *INQ and *OUTQ.  Return false if the
+   device cannot report them.  */
+
+static bool
+get_queue_depths (int fd, int *inq, int *outq)
+{
+#if defined TIOCINQ && defined TIOCOUTQ
+  return (timed_ioctl (fd, TIOCINQ, inq) == 0
+          && timed_ioctl (fd, TIOCOUTQ, outq) == 0);
+#else
+  errno = ENOTSUP;
+  return false;
+#endif
+}
+
+/* Output the queue depths of standard input, if it can report them.
+   It is an error if it cannot and !FANCY, that is, for "stty queue".  */
+
+static void
+display_queue (bool fancy, char const *device_name)
+{
+  int inq, outq;
+
+  if (! get_queue_depths (STDIN_FILENO, &inq, &outq))
+    {
+      if (!fancy)
+        error (EXIT_FAILURE, errno, _("%s: cannot get queue sizes"),
+               quotef (device_name));
+      return;
+    }
+
+  wrapf (fancy ? "queue in %d, out %d;" : "%d %d\n", inq, outq);
+  if (!fancy)
+    current_col = 0;
+}
+
+/* Every watch_queue_interval milliseconds, print the input and output
+   queue depths of standard input if USE_STDIN, and of the devices named
+   by the non-null elements of ARGV[1..ARGC-1], until wait_timeout
+   expires.  Each device is opened once, so a sample costs two ioctls per
+   device.  With several devices, each line starts with the device name.  */
+
+static void
+watch_queues (bool use_stdin, char const *device_name, int argc, char **argv)
+{
+  struct queue_source
+  {
+    int fd;
+    char const *name;
+    struct device_stats *stats;
+  } *src = xnmalloc (argc, sizeof *src);
+  int n = 0;
+  struct timespec deadline;
+
+  if (use_stdin)
+    src[n++] = (struct queue_source) { STDIN_FILENO, device_name,
+                                       stats_device };
+  for (int i = 1; i < argc; i++)
+    if (argv[i])
+      {
+        struct device_stats *stats = stats_new_device (argv[i]);
+        struct timespec start;
+        stats_start (&start);
+        int fd = open (argv[i], O_RDONLY | O_NONBLOCK | O_NOCTTY);
+        stats_stop (stat_open, &start);
+        if (fd < 0)
+          error (EXIT_FAILURE, errno, "%s", quotef (argv[i]));
+        src[n++] = (struct queue_source) { fd, argv[i], stats };
+      }
+
+  deadline_from_ms (&deadline, wait_timeout);
+
+  while (true)
+    {
+      for (int i = 0; i < n; i++)
+        {
+          int inq, outq;
+          stats_device = src[i].stats;
+          if (! get_queue_depths (src[i].fd, &inq, &outq))
+            error (EXIT_FAILURE, errno, _("%s: cannot get queue sizes"),
+                   quotef (src[i].name));
+          if (1 < n)
+            printf ("%s ", src[i].name);
+          printf ("%d %d\n", inq, outq);
+        }
+      if (fflush (stdout) != 0)
+        error (EXIT_FAILURE, errno, _("write error"));
+
+      int left = ms_until (&deadline);
+      if (left == 0)
+        break;
+      xnanosleep ((left < 0 ? watch_queue_interval
+                   : MIN (left, watch_queue_interval)) / 1000.0);
+      if (ms_until (&deadline) == 0)
+        break;
+    }
+
+  free (src);
+}
+
+#if USE_TIOCGICOUNT
+/* UART counters reported by "stty icount", and which count errors.  */
+static struct
+{
+  char const *name;
+  size_t offset;
+  bool error;
+} const icount_fields[] =
+{
+  {"rx", offsetof (struct serial_icounter_struct, rx), false},
+  {"tx", offsetof (struct serial_icounter_struct, tx), false},
+  {"frame", offsetof (struct serial_icounter_struct, frame), true},
+  {"overrun", offsetof (struct serial_icounter_struct, overrun), true},
+  {"parity", offsetof (struct serial_icounter_struct, parity), true},
+  {"brk", offsetof (struct serial_icounter_struct, brk), false},
+  {"buf_overrun", offsetof (struct serial_icounter_struct, buf_overrun),
+   true},
+};
+
+static unsigned int
+icount_field (struct serial_icounter_struct const *ic, int i)
+{
+  return *(int const *) ((char const *) ic + icount_fields[i].offset);
+}
+
+/* Output the counters IC, or if PREV is not null, how much they grew
+   since PREV along with the resulting receive error rate in parts per
+   million, either with wrapf or as a JSON object.  */
+
+static void
+print_icount (struct serial_icounter_struct const *ic,
+              struct serial_icounter_struct const *prev, bool as_json)
+{
+  uintmax_t errors = 0;
+
+  if (as_json)
+    putchar ('{');
+  for (int i = 0; i < countof (icount_fields); i++)
+    {
+      unsigned int value = icount_field (ic, i);
+      if (prev)
+        value -= icount_field (prev, i);
+      if (icount_fields[i].error)
+        errors += value;
+      if (as_json)
+        printf ("%s\"%s\": %u", i ? ", " : "", icount_fields[i].name, value);
+      else
+        wrapf ("%s = %u;", icount_fields[i].name, value);
+    }
+
+  if (prev)
+    {
+      unsigned int rx = icount_field (ic, 0) - icount_field (prev, 0);
+      uintmax_t ppm = rx ? errors * 1000000 / rx : 0;
+      if (as_json)
+        printf (", \"error_ppm\": %ju", ppm);
+      else
+        wrapf ("errors = %ju ppm;", ppm);
+    }
+
+  if (as_json)
+    putchar ('}');
+}
+#endif
+
+/* Output the UART counters of standard input.  If the device has none,
+   output nothing if FANCY, that is, for "stty -a", and otherwise fail.  */
+
+static void
+display_icount (bool fancy, char const *device_name)
+{
+#if USE_TIOCGICOUNT
+  struct serial_icounter_struct ic;
+
+  if (timed_ioctl (STDIN_FILENO, TIOCGICOUNT, &ic) == 0)
+    {
+      print_icount (&ic, nullptr, false);
+      putchar ('\n');
+      current_col = 0;
+      return;
+    }
+#else
+  errno = ENOTSUP;
+#endif
+  if (!fancy)
+    error (EXIT_FAILURE, errno, _("%s: cannot get serial counters"),
+           quotef (device_name));
+}
+
+/* Raise and lower the modem control lines of standard input
+   as requested.  */
+
+static void
+set_modem_lines (char const *device_name)
+{
+#if USE_TIOCM
+  if ((modem_set && timed_ioctl (STDIN_FILENO, TIOCMBIS, &modem_set) != 0)
+      || (modem_clear
+          && timed_ioctl (STDIN_FILENO, TIOCMBIC, &modem_clear) != 0))
+    error (EXIT_FAILURE, errno, _("%s: cannot set modem control lines"),
+           quotef (device_name));
+#endif
+}
+
+/* Return the TIOCM_* bits of the comma-separated modem input lines
+   named by ARG, for --wait-modem.  */
+
+static int
+parse_modem_lines (char const *arg)
+{
+#if USE_TIOCM
+  int bits = 0;
+  char const *p = arg;
+
+  while (true)
+    {
+      size_t len = strcspn (p, ",");
+      int i;
+      /* Skip the output lines DTR and RTS, which never change by
+         themselves.  */
+      for (i = 2; i < countof (modem_lines); i++)
+        if (strlen (modem_lines[i].name) == len
+            && STREQ_LEN (p, modem_lines[i].name, len))
+          break;
+      if (i == countof (modem_lines))
+        error (EXIT_FAILURE, 0, _("invalid modem line list %s"), quote (arg));
+      bits |= modem_lines[i].bit;
+      if (!p[len])
+        return bits;
+      p += len + 1;
+    }
+#else
+  error (EXIT_FAILURE, ENOTSUP, "--wait-modem");
+  return 0;
+#endif
+}
+
+#if USE_TIOCM
+static void
+print_modem_lines (int lines)
+{
+  for (int i = 0; i < countof (modem_lines); i++)
+    wrapf ("%s%s", lines & modem_lines[i].bit ? "" : "-",
+           modem_lines[i].name);
+  putchar ('\n');
+  current_col = 0;
+}
+#endif
+
+/* Output the modem control lines of standard input, as settings
+   with or without "-".  Fail if the device has none, unless FANCY.  */
+
+static void
+display_modem (bool fancy, char const *device_name)
+{
+#if USE_TIOCM
+  int lines;
+
+  if (timed_ioctl (STDIN_FILENO, TIOCMGET, &lines) == 0)
+    {
+      print_modem_lines (lines);
+      return;
+    }
+#else
+  errno = ENOTSUP;
+#endif
+  if (!fancy)
+    error (EXIT_FAILURE, errno, _("%s: cannot get modem control lines"),
+           quotef (device_name));
+}
+
+#if USE_TIOCM && defined TIOCMIWAIT
+static void
+interrupt_wait (MAYBE_UNUSED int sig)
+{
+}
+#endif
+
+/* Block until any of the wait_modem_lines of standard input changes,
+   and print the modem control lines as "stty modem" does.  Exit with
+   failure if --timeout expires first.  */
+
+static void
+wait_modem (char const *device_name)
+{
+#if USE_TIOCM && defined TIOCMIWAIT
+  /* TIOCMIWAIT has no timeout of its own, so interrupt it with
+     SIGALRM.  Without SA_RESTART the ioctl then fails with EINTR.  */
+  if (0 <= wait_timeout)
+    {
+      struct sigaction act = { .sa_handler = interrupt_wait };
+      sigemptyset (&act.sa_mask);
+      struct itimerval it = { .it_value = { .tv_sec = wait_timeout / 1000,
+                                            .tv_usec = wait_timeout % 1000
+                                                       * 1000 } };
+      if (it.it_value.tv_sec == 0 && it.it_value.tv_usec == 0)
+        error (EXIT_FAILURE, 0,
+               _("%s: timed out waiting for a modem line change"),
+               quotef (device_name));
+      if (sigaction (SIGALRM, &act, nullptr) != 0
+          || setitimer (ITIMER_REAL, &it, nullptr) != 0)
+        error (EXIT_FAILURE, errno, _("failed to set timer"));
+    }
+
+  struct timespec start;
+  stats_start (&start);
+  int ret = ioctl (STDIN_FILENO, TIOCMIWAIT, wait_modem_lines);
+  stats_stop (stat_ioctl, &start);
+  if (ret != 0)
+    {
+      if (errno == EINTR)
+        error (EXIT_FAILURE, 0,
+               _("%s: timed out waiting for a modem line change"),
+               quotef (device_name));
+      error (EXIT_FAILURE, errno, _("%s: cannot wait for modem line changes"),
+             quotef (device_name));
+    }
+
+  max_col = screen_columns ();
+  current_col = 0;
+  display_modem (false, device_name);
+#else
+  error (EXIT_FAILURE, 0,
+         _("%s: waiting for modem line changes is not supported"
+           " on this system"),
+         quotef (device_name));
+#endif
+}
+
+/* Every watch_icount_interval milliseconds until wait_timeout expires,
+   print how much the UART counters of standard input grew, as a line
+   of text or, if AS_JSON, as a JSON object per line.  */
+
+static void
+watch_icount (bool as_json, char const *device_name)
+{
+#if USE_TIOCGICOUNT
+  struct serial_icounter_struct ic, prev;
+  struct timespec deadline;
+
+  if (timed_ioctl (STDIN_FILENO, TIOCGICOUNT, &prev) != 0)
+    error (EXIT_FAILURE, errno, _("%s: cannot get serial counters"),
+           quotef (device_name));
+
+  deadline_from_ms (&deadline, wait_timeout);
+  max_col = screen_columns ();
+  current_col = 0;
+
+  while (true)
+    {
+      int left = ms_until (&deadline);
+      if (left == 0)
+        break;
+      xnanosleep ((left < 0 ? watch_icount_interval
+                   : MIN (left, watch_icount_interval)) / 1000.0);
+
+      if (timed_ioctl (STDIN_FILENO, TIOCGICOUNT, &ic) != 0)
+        error (EXIT_FAILURE, errno, _("%s: cannot get serial counters"),
+               quotef (device_name));
+      print_icount (&ic, &prev, as_json);
+      putchar ('\n');
+      current_col = 0;
+      if (fflush (stdout) != 0)
+        error (EXIT_FAILURE, errno, _("write error"));
+      prev = ic;
+    }
+#else
+  error (EXIT_FAILURE, ENOTSUP, _("%s: cannot get serial counters"),
+         quotef (device_name));
 #endif
+}
 
 static int get_window_columns(void)
 {
@@ -2096,6 +6079,8 @@ mode_type_flag (enum mode_type type, struct termios *mode)
     }
 }
 
+static void display_fingerprint (struct termios const *mode);
+
 static void
 display_settings (enum output_type output_type, struct termios *mode,
                   char const *device_name)
@@ -2113,6 +6098,14 @@ display_settings (enum output_type output_type, struct termios *mode,
     case recoverable:
       display_recoverable (mode);
       break;
+
+    case json:
+      display_json (mode, device_name);
+      break;
+
+    case fingerprint:
+      display_fingerprint (mode);
+      break;
     }
 }
 
@@ -2171,63 +6164,109 @@ static void display_control_chars(const struct termios *mode)
     current_col = 0;
 }
 
-static void handle_type_change(bool *empty_line, enum mode_type *prev_type, 
-                               enum mode_type new_type)
+/* The displayable entries of mode_info, one group per flag word, with
+   the effective mask and the 'sane' display rule resolved up front.
+   Each group is padded to MODE_SLOTS entries that never match, so the
+   per-word decision is a fixed-length branch-free pass over parallel
+   arrays that the compiler vectorizes; only the name output walks the
+   entries one at a time.  */
+
+enum { MODE_WORDS = combination };	/* control, input, output, local.  */
+enum { MODE_SLOTS = 32 };		/* Entries per word, with padding.  */
+
+struct mode_index
+  {
+    int count;				/* Entries actually in use.  */
+    short entry[MODE_SLOTS];		/* Index into mode_info.  */
+    tcflag_t bits[MODE_SLOTS];		/* Bits that select the mode.  */
+    tcflag_t mask[MODE_SLOTS];		/* Bits to compare.  */
+    unsigned char show_on[MODE_SLOTS];	/* Show when in effect.  */
+    unsigned char show_off[MODE_SLOTS];	/* Show when not in effect.  */
+  };
+
+static struct mode_index mode_index[MODE_WORDS];
+
+/* Fill mode_index from mode_info, once.  */
+
+static void
+mode_index_init (void)
 {
-    if (new_type != *prev_type)
+  static bool initialized;
+  if (initialized)
+    return;
+  initialized = true;
+
+  for (int w = 0; w < MODE_WORDS; w++)
+    for (int k = 0; k < MODE_SLOTS; k++)
+      mode_index[w].bits[k] = 1;	/* With mask 0, never matches.  */
+
+  for (int i = 0; mode_info[i].name != nullptr; ++i)
     {
-        if (!*empty_line)
-        {
-            putchar('\n');
-            current_col = 0;
-            *empty_line = true;
-        }
-        *prev_type = new_type;
+      if (mode_info[i].flags & OMIT)
+        continue;
+      affirm (mode_info[i].type < MODE_WORDS);
+      struct mode_index *ix = &mode_index[mode_info[i].type];
+      affirm (ix->count < MODE_SLOTS);
+      int k = ix->count++;
+      ix->entry[k] = i;
+      ix->bits[k] = mode_info[i].bits;
+      ix->mask[k] = mode_info[i].mask ? mode_info[i].mask : mode_info[i].bits;
+      ix->show_on[k] = (mode_info[i].flags & SANE_UNSET) != 0;
+      ix->show_off[k] = ((mode_info[i].flags & (SANE_SET | REV))
+                         == (SANE_SET | REV));
     }
 }
 
-static bool should_display_mode(tcflag_t bitsp_value, unsigned long mask, 
-                                unsigned long bits, int flags)
+/* Return the flag word of MODE that entries of group W test.  */
+
+ATTRIBUTE_PURE
+static tcflag_t
+mode_word (int w, struct termios const *mode)
 {
-    if ((bitsp_value & mask) == bits)
-    {
-        return (flags & SANE_UNSET) != 0;
-    }
-    return (flags & (SANE_SET | REV)) == (SANE_SET | REV);
+  return *mode_type_flag (w, (struct termios *) mode);
 }
 
-static void display_mode_name(const char *name, tcflag_t bitsp_value, 
-                              unsigned long mask, unsigned long bits, int flags)
+/* Set ON[K] to whether WORD has entry K of IX in effect, and SHOW[K]
+   to whether that state differs from 'sane' and so is worth listing
+   in the default output.  SHOW may be null.  */
+
+static void
+mode_index_decide (struct mode_index const *ix, tcflag_t word,
+                   unsigned char *restrict on, unsigned char *restrict show)
 {
-    if ((bitsp_value & mask) == bits)
-    {
-        wrapf("%s", name);
-    }
-    else
-    {
-        wrapf("-%s", name);
-    }
+  for (int k = 0; k < MODE_SLOTS; k++)
+    on[k] = (word & ix->mask[k]) == ix->bits[k];
+
+  if (show)
+    for (int k = 0; k < MODE_SLOTS; k++)
+      show[k] = ix->show_off[k] ^ (on[k] & (ix->show_on[k] ^ ix->show_off[k]));
 }
 
 static void display_mode_settings(const struct termios *mode)
 {
     bool empty_line = true;
-    enum mode_type prev_type = control;
-    
-    for (int i = 0; mode_info[i].name != nullptr; ++i)
+    unsigned char on[MODE_SLOTS], show[MODE_SLOTS];
+
+    mode_index_init();
+
+    for (int w = 0; w < MODE_WORDS; ++w)
     {
-        if (mode_info[i].flags & OMIT)
-            continue;
-        
-        handle_type_change(&empty_line, &prev_type, mode_info[i].type);
-        
-        tcflag_t *bitsp = mode_type_flag(mode_info[i].type, mode);
-        unsigned long mask = mode_info[i].mask ? mode_info[i].mask : mode_info[i].bits;
-        
-        if (should_display_mode(*bitsp, mask, mode_info[i].bits, mode_info[i].flags))
+        struct mode_index const *ix = &mode_index[w];
+
+        if (!empty_line)
+        {
+            putchar('\n');
+            current_col = 0;
+            empty_line = true;
+        }
+
+        mode_index_decide(ix, mode_word(w, mode), on, show);
+
+        for (int k = 0; k < ix->count; ++k)
         {
-            display_mode_name(mode_info[i].name, *bitsp, mask, 
-                            mode_info[i].bits, mode_info[i].flags);
+            if (!show[k])
+                continue;
+            wrapf("%s%s", on[k] ? "" : "-", mode_info[ix->entry[k]].name);
             empty_line = false;
         }
     }
@@ -2250,23 +6289,7 @@ static void display_changed(struct termios *mode)
     display_mode_settings(mode);
 }
 
-static int should_skip_control_info(const char *name, struct termios *mode)
-{
-#ifdef VFLUSHO
-    if (STREQ(name, "flush"))
-        return 1;
-#endif
-#if VSWTCH == VSUSP
-    if (STREQ(name, "swtch"))
-        return 1;
-#endif
-#if VEOF == VMIN
-    if ((mode->c_lflag & ICANON) == 0 && 
-        (STREQ(name, "eof") || STREQ(name, "eol")))
-        return 1;
-#endif
-    return 0;
-}
+static void display_read_timing(struct termios const *mode);
 
 static void display_control_info(struct termios *mode)
 {
@@ -2274,7 +6297,7 @@ static void display_control_info(struct termios *mode)
     
     for (i = 0; !STREQ(control_info[i].name, "min"); ++i)
     {
-        if (should_skip_control_info(control_info[i].name, mode))
+        if (should_skip_control_info(mode, i))
             continue;
         
         wrapf("%s = %s;", control_info[i].name,
@@ -2287,43 +6310,65 @@ static void display_control_info(struct termios *mode)
         wrapf("min = %lu; time = %lu;",
               (unsigned long int) mode->c_cc[VMIN],
               (unsigned long int) mode->c_cc[VTIME]);
+
+    if ((mode->c_lflag & ICANON) == 0)
+        display_read_timing(mode);
+}
+
+/* Output how long a non-canonical read waits after the last character
+   of a short burst, or for a full batch of min characters without
+   a timer.  */
+
+static void display_read_timing(struct termios const *mode)
+{
+    unsigned long int baud = line_baud(mode);
+    if (baud == 0)
+        return;
+
+    int bits = frame_bits(mode);
+    uintmax_t latency_us = (mode->c_cc[VTIME]
+                            ? mode->c_cc[VTIME] * UINTMAX_C(100000)
+                            : (mode->c_cc[VMIN] * UINTMAX_C(1000000) * bits
+                               + baud - 1) / baud);
+    wrapf("latency = %ju ms;", (latency_us + 999) / 1000);
 }
 
 static void display_mode_info(struct termios *mode)
 {
-    int i;
-    tcflag_t *bitsp;
-    unsigned long mask;
-    enum mode_type prev_type = control;
-    
-    for (i = 0; mode_info[i].name != nullptr; ++i)
+    unsigned char on[MODE_SLOTS];
+
+    mode_index_init();
+
+    for (int w = 0; w < MODE_WORDS; ++w)
     {
-        if (mode_info[i].flags & OMIT)
-            continue;
-        
-        if (mode_info[i].type != prev_type)
+        struct mode_index const *ix = &mode_index[w];
+
+        if (w != control)
         {
             putchar('\n');
             current_col = 0;
-            prev_type = mode_info[i].type;
         }
-        
-        bitsp = mode_type_flag(mode_info[i].type, mode);
-        mask = mode_info[i].mask ? mode_info[i].mask : mode_info[i].bits;
-        
-        if ((*bitsp & mask) == mode_info[i].bits)
-            wrapf("%s", mode_info[i].name);
-        else if (mode_info[i].flags & REV)
-            wrapf("-%s", mode_info[i].name);
+
+        mode_index_decide(ix, mode_word(w, mode), on, nullptr);
+
+        for (int k = 0; k < ix->count; ++k)
+        {
+            if (on[k])
+                wrapf("%s", mode_info[ix->entry[k]].name);
+            else if (mode_info[ix->entry[k]].flags & REV)
+                wrapf("-%s", mode_info[ix->entry[k]].name);
+        }
     }
 }
 
 static void display_header_info(struct termios *mode, char const *device_name)
 {
     display_speed(mode, true);
+    display_throughput(mode, true);
 #ifdef TIOCGWINSZ
     display_window_size(true, device_name);
 #endif
+    display_queue(true, device_name);
 #ifdef HAVE_C_LINE
     wrapf("line = %d;", mode->c_line);
 #endif
@@ -2343,7 +6388,70 @@ static void display_all(struct termios *mode, char const *device_name)
     display_mode_info(mode);
     putchar('\n');
     current_col = 0;
+
+#if USE_TIOCSSERIAL
+    display_serial_info();
+#endif
+#if USE_TIOCSRS485
+    display_rs485_info();
+#endif
+    display_icount(true, device_name);
+}
+
+#if USE_TIOCSSERIAL
+/* Output the UART driver settings, if the device has any.  */
+
+static void display_serial_info(void)
+{
+    struct serial_struct ss;
+
+    if (timed_ioctl(STDIN_FILENO, TIOCGSERIAL, &ss) != 0)
+        return;
+
+    wrapf("%slow_latency", ss.flags & ASYNC_LOW_LATENCY ? "" : "-");
+    wrapf("xmit_fifo_size = %d;", ss.xmit_fifo_size);
+    wrapf("close_delay = %d ms;", ss.close_delay * 10);
+    if (ss.closing_wait == ASYNC_CLOSING_WAIT_NONE) {
+        wrapf("closing_wait = none;");
+    } else if (ss.closing_wait == ASYNC_CLOSING_WAIT_INF) {
+        wrapf("closing_wait = infinite;");
+    } else {
+        wrapf("closing_wait = %d ms;", ss.closing_wait * 10);
+    }
+    putchar('\n');
+    current_col = 0;
+}
+#endif
+
+#if USE_TIOCSRS485
+/* Output the RS-485 settings, if the device has any.  */
+
+static void display_rs485_info(void)
+{
+    struct serial_rs485 rs;
+
+    if (timed_ioctl(STDIN_FILENO, TIOCGRS485, &rs) != 0)
+        return;
+
+    for (int i = 0; i < countof(rs485_flags); i++)
+        wrapf("%s%s", rs.flags & rs485_flags[i].flag ? "" : "-",
+              rs485_flags[i].name);
+    wrapf("rts_delay_before = %" PRIu32 " ms;", rs.delay_rts_before_send);
+    wrapf("rts_delay_after = %" PRIu32 " ms;", rs.delay_rts_after_send);
+    putchar('\n');
+    current_col = 0;
+}
+
+/* Store the RS-485 settings RS as the fields that -g appends, each
+   preceded by a colon, into BUF, and return their length.  */
+
+static int format_rs485(char *buf, struct serial_rs485 const *rs)
+{
+    return sprintf(buf, ":%" PRIx32 ":%" PRIx32 ":%" PRIx32,
+                   rs->flags & RS485_FLAGS, rs->delay_rts_before_send,
+                   rs->delay_rts_after_send);
 }
+#endif
 
 /* Verify requested asymmetric speeds are supported.
    Note we don't flag the case where only ispeed or
@@ -2379,16 +6487,389 @@ display_speed (struct termios *mode, bool fancy)
     current_col = 0;
 }
 
+/* Store the -g representation of MODE, followed by the RS-485 settings
+   of standard input if it has any, with a trailing newline, into BUF
+   of size RECOVERABLE_BUFSIZE.  Return its length.  */
+
+static int
+format_recoverable (char *buf, struct termios const *mode)
+{
+  int len = format_modes (buf, mode);
+#if USE_TIOCSRS485
+  struct serial_rs485 rs;
+  if (timed_ioctl (STDIN_FILENO, TIOCGRS485, &rs) == 0)
+    len += format_rs485 (buf + len, &rs);
+#endif
+  buf[len++] = '\n';
+  buf[len] = '\0';
+  return len;
+}
+
+/* Store the flags and control characters of MODE in the -g format,
+   without a newline, into BUF, and return its length.  */
+
+static int
+format_modes (char *buf, struct termios const *mode)
+{
+  int len = sprintf (buf, "%lx:%lx:%lx:%lx",
+                     (unsigned long int) mode->c_iflag,
+                     (unsigned long int) mode->c_oflag,
+                     (unsigned long int) mode->c_cflag,
+                     (unsigned long int) mode->c_lflag);
+  for (size_t i = 0; i < NCCS; ++i)
+    len += sprintf (buf + len, ":%lx", (unsigned long int) mode->c_cc[i]);
+  return len;
+}
+
+/* Output the characters per second the line speed allows with the
+   character format of MODE, the data bytes per second they carry, and
+   the characters of text per second after output processing.  The
+   fancy format shows the last only when it differs, and nothing if the
+   speed is unknown.  */
+
+static void
+display_throughput (struct termios const *mode, bool fancy)
+{
+  unsigned long int baud = line_baud (mode);
+  unsigned long int chars = baud / frame_bits (mode);
+  unsigned long int bytes = chars * char_bits (mode) / 8;
+  unsigned long int text = text_chars (mode, chars);
+
+  if (fancy)
+    {
+      if (baud)
+        wrapf ("throughput %lu chars/s, %lu bytes/s;", chars, bytes);
+      if (text != chars)
+        wrapf ("text %lu chars/s;", text);
+    }
+  else
+    {
+      wrapf ("%lu %lu %lu\n", chars, bytes, text);
+      current_col = 0;
+    }
+}
+
 static void
 display_recoverable (struct termios *mode)
 {
-  printf ("%lx:%lx:%lx:%lx",
-          (unsigned long int) mode->c_iflag,
-          (unsigned long int) mode->c_oflag,
-          (unsigned long int) mode->c_cflag,
-          (unsigned long int) mode->c_lflag);
-  for (size_t i = 0; i < NCCS; ++i)
-    printf (":%lx", (unsigned long int) mode->c_cc[i]);
+  char buf[RECOVERABLE_BUFSIZE];
+  format_recoverable (buf, mode);
+  fputs (buf, stdout);
+}
+
+/* Return the FP_* bits named in the comma-separated list ARG.  */
+
+static int
+parse_fingerprint_fields (char *arg)
+{
+  int fields = 0;
+  for (char *field = strtok (arg, ","); field; field = strtok (nullptr, ","))
+    fields |= XARGMATCH ("--fields", field,
+                         fingerprint_field_args, fingerprint_field_types);
+  if (!fields)
+    error (EXIT_FAILURE, 0, _("invalid --fields argument %s"), quote (arg));
+  return fields;
+}
+
+/* Return H updated with the N bytes at BUF, by 64-bit FNV-1a.  */
+
+static uint64_t
+fingerprint_add (uint64_t h, void const *buf, size_t n)
+{
+  unsigned char const *p = buf;
+  for (size_t i = 0; i < n; i++)
+    h = (h ^ p[i]) * UINT64_C (0x100000001b3);
+  return h;
+}
+
+/* Return H updated with the string S, including its null byte.  */
+
+static uint64_t
+fingerprint_add_name (uint64_t h, char const *s)
+{
+  return fingerprint_add (h, s, strlen (s) + 1);
+}
+
+/* Return H updated with V as 4 little-endian bytes, so that the hash
+   does not depend on the byte order or the width of tcflag_t.  */
+
+static uint64_t
+fingerprint_add_value (uint64_t h, uint_least32_t v)
+{
+  unsigned char b[4] = { v & 0xff, (v >> 8) & 0xff,
+                         (v >> 16) & 0xff, (v >> 24) & 0xff };
+  return fingerprint_add (h, b, sizeof b);
+}
+
+/* Output a hash of the parts of MODE selected by --fields, normalized
+   so that settings with the same effect hash alike: flag words are
+   masked to the bits some mode in mode_info uses, control characters
+   are taken by name and skipped where they are aliases or unused, and
+   an input speed of 0 means the output speed.  Each part is preceded
+   by its name, so that different selections do not collide.  */
+
+static void
+display_fingerprint (struct termios const *mode)
+{
+  int fields = fingerprint_fields ? fingerprint_fields : FP_ALL;
+  uint64_t h = UINT64_C (0xcbf29ce484222325);
+
+  for (int w = control; w < combination; w++)
+    if (fields & (1 << w))
+      {
+        tcflag_t used = 0;
+        for (int i = 0; mode_info[i].name != nullptr; ++i)
+          if (mode_info[i].type == w)
+            used |= mode_info[i].bits | mode_info[i].mask;
+        h = fingerprint_add_name (h, fingerprint_field_args[w]);
+        h = fingerprint_add_value (h, mode_word (w, mode) & used);
+      }
+
+  if (fields & FP_CC)
+    {
+      h = fingerprint_add_name (h, "cc");
+      for (int i = 0; control_info[i].name != nullptr; ++i)
+        {
+          if (should_skip_control_info (mode, i))
+            continue;
+          /* Canonical reads ignore min and time.  */
+          if ((mode->c_lflag & ICANON)
+              && (STREQ (control_info[i].name, "min")
+                  || STREQ (control_info[i].name, "time")))
+            continue;
+          h = fingerprint_add_name (h, control_info[i].name);
+          h = fingerprint_add (h, &mode->c_cc[control_info[i].offset], 1);
+        }
+    }
+
+  if (fields & FP_SPEED)
+    {
+      speed_t ospeed = cfgetospeed (mode);
+      speed_t ispeed = cfgetispeed (mode);
+      h = fingerprint_add_name (h, "speed");
+      h = fingerprint_add_value (h, baud_to_value (ospeed));
+      h = fingerprint_add_value (h, baud_to_value (ispeed ? ispeed : ospeed));
+    }
+
+  printf ("%016" PRIx64 "\n", h);
+}
+
+/* Output all settings of MODE as one JSON object.  */
+
+static void
+display_json (struct termios *mode, char const *device_name)
+{
+  unsigned long int baud = line_baud (mode);
+  char const *sep = "";
+
+  fputs ("{\"device\": ", stdout);
+  json_string (stdout, device_name);
+  printf (", \"ispeed\": %lu, \"ospeed\": %lu",
+          baud_to_value (cfgetispeed (mode)),
+          baud_to_value (cfgetospeed (mode)));
+  if (baud)
+    printf (", \"throughput\": {\"chars_per_sec\": %lu,"
+            " \"bytes_per_sec\": %lu, \"text_chars_per_sec\": %lu}",
+            baud / frame_bits (mode),
+            baud / frame_bits (mode) * char_bits (mode) / 8,
+            text_chars (mode, baud / frame_bits (mode)));
+#ifdef TIOCGWINSZ
+  struct winsize win;
+  if (get_win_size (STDIN_FILENO, &win) == 0)
+    printf (", \"rows\": %d, \"columns\": %d", win.ws_row, win.ws_col);
+#endif
+#ifdef HAVE_C_LINE
+  printf (", \"line\": %d", mode->c_line);
+#endif
+
+  fputs (", \"control\": {", stdout);
+  for (int i = 0; !STREQ (control_info[i].name, "min"); ++i)
+    {
+      if (should_skip_control_info (mode, i))
+        continue;
+      printf ("%s\"%s\": ", sep, control_info[i].name);
+      json_string (stdout, visible (mode->c_cc[control_info[i].offset]));
+      sep = ", ";
+    }
+  printf ("%s\"min\": %lu, \"time\": %lu}", sep,
+          (unsigned long int) mode->c_cc[VMIN],
+          (unsigned long int) mode->c_cc[VTIME]);
+
+  sep = "";
+  fputs (", \"modes\": {", stdout);
+  mode_index_init ();
+  for (int w = 0; w < MODE_WORDS; w++)
+    {
+      struct mode_index const *ix = &mode_index[w];
+      unsigned char on[MODE_SLOTS];
+      mode_index_decide (ix, mode_word (w, mode), on, nullptr);
+      for (int k = 0; k < ix->count; k++)
+        {
+          printf ("%s\"%s\": %s", sep, mode_info[ix->entry[k]].name,
+                  on[k] ? "true" : "false");
+          sep = ", ";
+        }
+    }
+  putchar ('}');
+
+  int inq, outq;
+  if (get_queue_depths (STDIN_FILENO, &inq, &outq))
+    printf (", \"queue\": {\"input\": %d, \"output\": %d}", inq, outq);
+
+#if USE_TIOCM
+  int lines;
+  if (timed_ioctl (STDIN_FILENO, TIOCMGET, &lines) == 0)
+    {
+      sep = "";
+      fputs (", \"modem\": {", stdout);
+      for (int i = 0; i < countof (modem_lines); i++)
+        {
+          printf ("%s\"%s\": %s", sep, modem_lines[i].name,
+                  lines & modem_lines[i].bit ? "true" : "false");
+          sep = ", ";
+        }
+      putchar ('}');
+    }
+#endif
+
+#if USE_TIOCGICOUNT
+  struct serial_icounter_struct ic;
+  if (timed_ioctl (STDIN_FILENO, TIOCGICOUNT, &ic) == 0)
+    {
+      fputs (", \"icount\": ", stdout);
+      print_icount (&ic, nullptr, true);
+    }
+#endif
+
+#if USE_TIOCSSERIAL
+  struct serial_struct ss;
+  if (timed_ioctl (STDIN_FILENO, TIOCGSERIAL, &ss) == 0)
+    {
+      printf (", \"serial\": {\"low_latency\": %s, \"xmit_fifo_size\": %d,"
+              " \"close_delay_ms\": %d, \"closing_wait_ms\": ",
+              ss.flags & ASYNC_LOW_LATENCY ? "true" : "false",
+              ss.xmit_fifo_size, ss.close_delay * 10);
+      /* Not waiting at all is a wait of 0; waiting forever has no bound.  */
+      if (ss.closing_wait == ASYNC_CLOSING_WAIT_NONE)
+        fputs ("0}", stdout);
+      else if (ss.closing_wait == ASYNC_CLOSING_WAIT_INF)
+        fputs ("null}", stdout);
+      else
+        printf ("%d}", ss.closing_wait * 10);
+    }
+#endif
+
+#if USE_TIOCSRS485
+  struct serial_rs485 rs;
+  if (timed_ioctl (STDIN_FILENO, TIOCGRS485, &rs) == 0)
+    {
+      fputs (", \"rs485\": {", stdout);
+      for (int i = 0; i < countof (rs485_flags); i++)
+        printf ("%s\"%s\": %s", i ? ", " : "", rs485_flags[i].name,
+                rs.flags & rs485_flags[i].flag ? "true" : "false");
+      printf (", \"rts_delay_before_ms\": %" PRIu32
+              ", \"rts_delay_after_ms\": %" PRIu32 "}",
+              rs.delay_rts_before_send, rs.delay_rts_after_send);
+    }
+#endif
+
+  puts ("}");
+}
+
+/* Bytes transferred in each direction by --bench.  */
+enum { BENCH_BYTES = 1 << 20 };
+
+/* Write BENCH_BYTES of 64-byte lines to WFD and read them back from RFD,
+   discarding anything that becomes readable on WFD (such as echo).
+   Both descriptors must be non-blocking.  Return the nanoseconds
+   taken, or -1 if the transfer stalled for a second, for instance
+   because the settings discard some of the input.  */
+
+static intmax_t
+pty_transfer (int wfd, int rfd)
+{
+  static char const line[] =
+    "The quick brown fox jumps over the lazy dog; 0123456789 ABCDEFG\n";
+  char buf[BUFSIZ];
+  size_t written = 0, received = 0;
+  struct timespec start;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  while (written < BENCH_BYTES || received < written)
+    {
+      struct pollfd pfd[2] =
+        {
+          { .fd = wfd, .events = POLLIN | (written < BENCH_BYTES ? POLLOUT : 0) },
+          { .fd = rfd, .events = POLLIN },
+        };
+      int n = poll (pfd, 2, 1000);
+      if (n < 0 && errno != EINTR)
+        error (EXIT_FAILURE, errno, _("pty benchmark failed"));
+      if (n == 0)
+        return -1;
+
+      if (pfd[0].revents & POLLIN)
+        ignore_value (read (wfd, buf, sizeof buf));
+      if (pfd[0].revents & POLLOUT)
+        {
+          size_t off = written % (sizeof line - 1);
+          ssize_t w = write (wfd, line + off,
+                             MIN (sizeof line - 1 - off,
+                                  BENCH_BYTES - written));
+          if (0 < w)
+            written += w;
+        }
+      if (pfd[1].revents & POLLIN)
+        {
+          ssize_t r = read (rfd, buf, sizeof buf);
+          if (0 < r)
+            received += r;
+        }
+    }
+
+  struct timespec end;
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  return ((intmax_t) (end.tv_sec - start.tv_sec) * 1000000000
+          + (end.tv_nsec - start.tv_nsec));
+}
+
+/* Measure the rate at which the tty layer passes input and output
+   through a local pty with the settings of MODE, which shows the cost
+   of processing such as opost, echo and icanon independently of the
+   line speed, and print the results in bytes per second.  */
+
+static void
+bench_throughput (struct termios const *mode, char const *device_name)
+{
+  int master = posix_openpt (O_RDWR | O_NOCTTY | O_NONBLOCK);
+  char const *slave_name;
+  int slave;
+
+  if (master < 0 || grantpt (master) != 0 || unlockpt (master) != 0
+      || ! (slave_name = ptsname (master))
+      || (slave = open (slave_name, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0)
+    error (EXIT_FAILURE, errno, _("cannot create a pty for benchmarking"));
+
+  if (tcsetattr (slave, TCSANOW, mode) != 0)
+    error (EXIT_FAILURE, errno, _("%s: cannot apply settings to a pty"),
+           quotef (device_name));
+
+  intmax_t in_ns = pty_transfer (master, slave);
+  intmax_t out_ns = pty_transfer (slave, master);
+  close (slave);
+  close (master);
+
+  if (in_ns < 0)
+    fputs (_("input stalled;"), stdout);
+  else
+    printf (_("input %ju bytes/s;"),
+            (uintmax_t) (BENCH_BYTES * 1e9 / MAX (in_ns, 1)));
+  putchar (' ');
+  if (out_ns < 0)
+    fputs (_("output stalled"), stdout);
+  else
+    printf (_("output %ju bytes/s"),
+            (uintmax_t) (BENCH_BYTES * 1e9 / MAX (out_ns, 1)));
   putchar ('\n');
 }
 
@@ -2442,10 +6923,11 @@ static bool parse_flags(char const **s, tcflag_t *flags)
     return true;
 }
 
-static bool parse_control_char(char const **s, cc_t *cc, size_t index)
+static bool parse_control_char(char const **s, cc_t *cc, size_t index,
+                               char end)
 {
     char *p;
-    char delim = index < NCCS - 1 ? ':' : '\0';
+    char delim = index < NCCS - 1 ? ':' : end;
     if (strtoul_cc_t(*s, 16, &p, cc, delim) != 0)
         return false;
     *s = p + 1;
@@ -2471,27 +6953,84 @@ static bool parse_terminal_flags(char const **s, struct termios *mode)
     return true;
 }
 
-static bool parse_control_characters(char const **s, struct termios *mode)
+static bool parse_control_characters(char const **s, struct termios *mode,
+                                     char end)
 {
     size_t i;
     
     for (i = 0; i < NCCS; ++i)
     {
-        if (!parse_control_char(s, mode->c_cc + i, i))
+        if (!parse_control_char(s, mode->c_cc + i, i, end))
+            return false;
+    }
+    
+    return true;
+}
+
+#if USE_TIOCSRS485
+/* Return the RS-485 fields of the -g string ARG, which follow the colon
+   after its control characters, or null if it has none.  */
+static char const *rs485_fields(char const *arg)
+{
+    for (int i = 0; i < 4 + NCCS; i++)
+    {
+        arg = strchr(arg, ':');
+        if (arg == nullptr)
+            return nullptr;
+        arg++;
+    }
+    return arg;
+}
+
+/* Parse S, the RS-485 fields of a -g string, into *RS.
+   Return false if any of them is invalid.  */
+static bool parse_rs485(char const *s, struct serial_rs485 *rs)
+{
+    uint32_t field[RS485_FIELDS];
+    
+    for (int i = 0; i < RS485_FIELDS; i++)
+    {
+        char *p;
+        errno = 0;
+        unsigned long ul = strtoul(s, &p, 16);
+        if (errno || p == s || *p != (i < RS485_FIELDS - 1 ? ':' : '\0')
+            || (uint32_t) ul != ul)
             return false;
+        field[i] = ul;
+        s = p + 1;
     }
+    if (field[0] & ~RS485_FLAGS)
+        return false;
     
+    memset(rs, 0, sizeof *rs);
+    rs->flags = field[0];
+    rs->delay_rts_before_send = field[1];
+    rs->delay_rts_after_send = field[2];
     return true;
 }
+#endif
 
 static bool recover_mode(char const *arg, struct termios *mode)
 {
     char const *s = arg;
+    char end = '\0';
+    
+#if USE_TIOCSRS485
+    /* The RS-485 fields are not part of MODE; just check them here.  */
+    char const *rs485 = rs485_fields(arg);
+    struct serial_rs485 rs;
+    if (rs485)
+    {
+        if (!parse_rs485(rs485, &rs))
+            return false;
+        end = ':';
+    }
+#endif
     
     if (!parse_terminal_flags(&s, mode))
         return false;
     
-    if (!parse_control_characters(&s, mode))
+    if (!parse_control_characters(&s, mode, end))
         return false;
     
     return true;